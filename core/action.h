@@ -5,8 +5,10 @@
       /** These are basic instructions that a machine can execute. They map to the
           below functions. M_ERR should be used to signify instructions that don't
           make sense (e.g. instructions issued after a program has halted, or when
-          the program has not halted and there are no further instructions). **/
-   typedef enum { M_LEFT, M_RIGHT, M_PRINT, M_ERR } Action;
+          the program has not halted and there are no further instructions).
+          M_PRINT_LEFT and M_PRINT_RIGHT print, then move, in a single step,
+          as a rule of a quintuple program does. **/
+   typedef enum { M_LEFT, M_RIGHT, M_PRINT, M_PRINT_LEFT, M_PRINT_RIGHT, M_ERR } Action;
 
 #endif
 
@@ -0,0 +1,323 @@
+
+// Headers.
+// ======================================================================
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+
+
+// Data structures.
+// ======================================================================
+
+#define CACHE_MAGIC "TMR"
+#define CACHE_VERSION 1
+#define CACHE_DEFAULT_SIZE (16L << 20)
+#define CACHE_SIZE_FILE ".size"
+
+   /**
+      The start of a result file. It is followed by the inputs, each with
+      a null after it, args_len bytes in all. result_size is
+      sizeof(Result), so that files written by a build with another layout
+      are ignored.
+   **/
+struct entry {
+   char magic[4];
+   uint32_t version;
+   uint32_t result_size;
+   uint32_t args_len;
+   uint64_t fingerprint;
+   Result result;
+};
+
+struct cache {
+   char *dir;
+   long max_bytes;
+};
+
+   /**
+      A file in the cache, for eviction.
+   **/
+struct file {
+   struct timespec used;
+   long size;
+   char name[32];
+};
+
+
+
+// Private functions.
+// ======================================================================
+
+   /**
+      Make dir and any of its parents that are missing.
+   **/
+static int make_dirs (char *dir)
+{
+   char path[PATH_MAX];
+   snprintf(path, sizeof(path), "%s", dir);
+   char *p;
+   for (p = path + 1; *p != '\0'; p++) {
+      if (*p != '/') continue;
+      *p = '\0';
+      if (mkdir(path, 0755) == -1 && errno != EEXIST) return -1;
+      *p = '/';
+   }
+   if (mkdir(path, 0755) == -1 && errno != EEXIST) return -1;
+   return 0;
+}
+
+   /**
+      Lay out the inputs as they are stored: each followed by a null.
+      Returns a buffer the caller frees, and its length in len.
+   **/
+static char *pack_args (char **args, int n, long *len)
+{
+   long total = 0;
+   int i;
+   for (i=0; i < n; i++) {
+      total += strlen(args[i]) + 1;
+   }
+   char *packed = malloc(total > 0 ? total : 1);
+   char *p = packed;
+   for (i=0; i < n; i++) {
+      long k = strlen(args[i]) + 1;
+      memcpy(p, args[i], k);
+      p += k;
+   }
+   *len = total;
+   return packed;
+}
+
+   /**
+      The path of the file for a key: a 64-bit FNV-1a hash of the
+      fingerprint and the packed inputs.
+   **/
+static void entry_path (Cache *cache, unsigned long fingerprint,
+                        char *packed, long len, char *path)
+{
+   uint64_t h = 0xCBF29CE484222325UL;
+   int i;
+   for (i=0; i < 8; i++) {
+      h = (h ^ ((fingerprint >> (8 * i)) & 0xFF)) * 0x100000001B3UL;
+   }
+   long k;
+   for (k=0; k < len; k++) {
+      h = (h ^ (unsigned char)packed[k]) * 0x100000001B3UL;
+   }
+   snprintf(path, PATH_MAX, "%s/%016lx", cache->dir, (unsigned long)h);
+}
+
+static int cmp_used (const void *a, const void *b)
+{
+   const struct file *f = a, *g = b;
+   if (f->used.tv_sec != g->used.tv_sec)
+      return f->used.tv_sec < g->used.tv_sec ? -1 : 1;
+   if (f->used.tv_nsec != g->used.tv_nsec)
+      return f->used.tv_nsec < g->used.tv_nsec ? -1 : 1;
+   return 0;
+}
+
+   /**
+      The space a file takes up on disk, which is what the limit is on:
+      results are far smaller than a block.
+   **/
+static long disk_size (struct stat *st)
+{
+   return (long)st->st_blocks * 512;
+}
+
+   /**
+      Delete the least recently used results until the cache is down to
+      three quarters of its limit. A result's modification time is when it
+      was last used, since hits touch it. Returns the space the cache takes
+      up afterwards.
+   **/
+static long evict (Cache *cache)
+{
+   DIR *d = opendir(cache->dir);
+   if (d == NULL)
+      return 0;
+   struct file *files = NULL;
+   int n = 0, capacity = 0;
+   long total = 0;
+   struct dirent *ent;
+   char path[PATH_MAX];
+   while ((ent = readdir(d)) != NULL) {
+      struct stat st;
+      if (ent->d_name[0] == '.' || strlen(ent->d_name) >= sizeof(files->name)) continue;
+      snprintf(path, sizeof(path), "%s/%s", cache->dir, ent->d_name);
+      if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) continue;
+      if (n == capacity) {
+         capacity = capacity > 0 ? capacity * 2 : 64;
+         files = realloc(files, capacity * sizeof(struct file));
+      }
+      files[n].used = st.st_mtim;
+      files[n].size = disk_size(&st);
+      strcpy(files[n].name, ent->d_name);
+      total += files[n].size;
+      n++;
+   }
+   closedir(d);
+
+   qsort(files, n, sizeof(struct file), cmp_used);
+   int i;
+   for (i=0; i < n && total > cache->max_bytes / 4 * 3; i++) {
+      snprintf(path, sizeof(path), "%s/%s", cache->dir, files[i].name);
+      if (unlink(path) == 0) total -= files[i].size;
+   }
+   free(files);
+   return total;
+}
+
+   /**
+      Add added bytes to the running total of the space the cache takes up,
+      which is kept in CACHE_SIZE_FILE so that every process sharing the
+      cache adds to it. Only when it goes over the limit is the directory
+      scanned, which evicts and puts the real total back. Replacing a result
+      counts it twice, so the total can run ahead, which only means the
+      scan comes sooner.
+   **/
+static void account (Cache *cache, long added)
+{
+   char path[PATH_MAX];
+   snprintf(path, sizeof(path), "%s/%s", cache->dir, CACHE_SIZE_FILE);
+   int fd = open(path, O_RDWR | O_CREAT, 0644);
+   if (fd == -1)
+      return;
+   flock(fd, LOCK_EX);
+   long total = 0;
+   if (pread(fd, &total, sizeof(total), 0) != sizeof(total) || total < 0)
+      total = 0;
+   total += added;
+   if (total > cache->max_bytes)
+      total = evict(cache);
+   pwrite(fd, &total, sizeof(total), 0);
+   flock(fd, LOCK_UN);
+   close(fd);
+}
+
+
+
+// Public functions.
+// ======================================================================
+
+Cache *Cache_Open (char *dir, long max_bytes)
+{
+   if (make_dirs(dir) == -1)
+      return NULL;
+   Cache *cache = malloc(sizeof(Cache));
+   cache->dir = strdup(dir);
+   cache->max_bytes = max_bytes;
+   return cache;
+}
+
+Cache *Cache_OpenDefault (void)
+{
+   char dir[PATH_MAX];
+   char *env = getenv("TURING_CACHE");
+   char *xdg = getenv("XDG_CACHE_HOME");
+   char *home = getenv("HOME");
+   if (env != NULL && *env != '\0')
+      snprintf(dir, sizeof(dir), "%s", env);
+   else if (xdg != NULL && *xdg != '\0')
+      snprintf(dir, sizeof(dir), "%s/turing", xdg);
+   else if (home != NULL && *home != '\0')
+      snprintf(dir, sizeof(dir), "%s/.cache/turing", home);
+   else
+      return NULL;
+
+   long max_bytes = CACHE_DEFAULT_SIZE;
+   char *size = getenv("TURING_CACHE_SIZE");
+   if (size != NULL && *size != '\0')
+      max_bytes = atol(size);
+   return Cache_Open(dir, max_bytes);
+}
+
+void Cache_Close (Cache *cache)
+{
+   free(cache->dir);
+   free(cache);
+}
+
+int Cache_Get (Cache *cache, unsigned long fingerprint, char **args, int n,
+               Result *result)
+{
+   long len;
+   char *packed = pack_args(args, n, &len);
+   char path[PATH_MAX];
+   entry_path(cache, fingerprint, packed, len, path);
+
+   // Read the file and check it's for this key.
+   int hit = 0;
+   int fd = open(path, O_RDONLY);
+   if (fd != -1) {
+      struct entry e;
+      char *stored = malloc(len > 0 ? len : 1);
+      if (read(fd, &e, sizeof(e)) == sizeof(e)
+          && memcmp(e.magic, CACHE_MAGIC, 4) == 0
+          && e.version == CACHE_VERSION
+          && e.result_size == sizeof(Result)
+          && e.fingerprint == fingerprint
+          && e.args_len == len
+          && read(fd, stored, len) == len
+          && memcmp(stored, packed, len) == 0) {
+         *result = e.result;
+         hit = 1;
+
+         // Mark it as used, for eviction.
+         futimens(fd, NULL);
+      }
+      free(stored);
+      close(fd);
+   }
+   free(packed);
+   return hit;
+}
+
+void Cache_Put (Cache *cache, unsigned long fingerprint, char **args, int n,
+                Result *result)
+{
+   long len;
+   char *packed = pack_args(args, n, &len);
+   char path[PATH_MAX], tmp[PATH_MAX];
+   entry_path(cache, fingerprint, packed, len, path);
+   snprintf(tmp, sizeof(tmp), "%s/.tmp.%ld", cache->dir, (long)getpid());
+
+   // Write it beside the real file, then move it into place.
+   struct entry e;
+   memset(&e, 0, sizeof(e));
+   memcpy(e.magic, CACHE_MAGIC, 4);
+   e.version = CACHE_VERSION;
+   e.result_size = sizeof(Result);
+   e.args_len = len;
+   e.fingerprint = fingerprint;
+   e.result = *result;
+   int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd != -1) {
+      struct stat st;
+      int ok = write(fd, &e, sizeof(e)) == sizeof(e) && write(fd, packed, len) == len
+               && fstat(fd, &st) == 0;
+      close(fd);
+      if (!ok || rename(tmp, path) == -1) {
+         unlink(tmp);
+      }
+      else {
+         // Blocks may not be allocated yet; a result takes up at least one.
+         long size = disk_size(&st);
+         account(cache, size > st.st_blksize ? size : st.st_blksize);
+      }
+   }
+   free(packed);
+}
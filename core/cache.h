@@ -0,0 +1,77 @@
+
+/* This module keeps the results of runs on disk, so that asking for the same
+   program on the same inputs again costs a lookup instead of a run. Results
+   are keyed by the program's fingerprint (see Prog_Fingerprint) and its
+   inputs, so renaming a program's states or reordering its clauses doesn't
+   lose its results. Each result is a small file in the cache directory,
+   named after a hash of its key; the key itself is stored in the file and
+   checked, so two keys with the same hash just miss.
+
+   The cache is kept under a limit on the disk space its files take up. A
+   running total is kept as results are stored; when it goes over the limit,
+   the least recently used results are deleted until they take up three
+   quarters of it. Several processes can share a cache: results are written
+   to a temporary file and renamed into place, so a reader never sees half a
+   result. */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+   #include "program.h"
+
+   // How many numbers decoded off the final tape a result keeps.
+   #define CACHE_NUMS 16
+
+      /**
+         The result of running a program.
+            steps : the number of steps it ran for.
+            halted : whether it halted (rather than being stopped).
+            state : the canonical number of the state it finished in (see
+               Prog_CanonicalId), or -1 if it errored out.
+            ones : the number of 1s on the final tape.
+            tape_hash : the hash of the final tape and head (M_TapeHash).
+            found : how many numbers there were on the final tape, of which
+               the first CACHE_NUMS are kept in nums.
+      **/
+   typedef struct result {
+      long steps;
+      int halted;
+      int state;
+      long ones;
+      unsigned long tape_hash;
+      long found;
+      long nums[CACHE_NUMS];
+   } Result;
+
+   typedef struct cache Cache;
+
+      /**
+         Open the cache in dir, creating it if need be, with a limit of
+         max_bytes. Returns NULL if the directory can't be made.
+         Cache_OpenDefault uses the directory named by TURING_CACHE, or
+         else turing in the user's cache directory ($XDG_CACHE_HOME, or
+         ~/.cache), and the limit in bytes given by TURING_CACHE_SIZE (16
+         MB if it isn't set).
+      **/
+   Cache *Cache_Open (char *dir, long max_bytes);
+   Cache *Cache_OpenDefault (void);
+   void Cache_Close (Cache *cache);
+
+      /**
+         Look up the result of running the program with the given
+         fingerprint on the n inputs in args. Returns non-zero and fills
+         in result if there is one.
+      **/
+   int Cache_Get (Cache *cache, unsigned long fingerprint, char **args, int n,
+                  Result *result);
+
+      /**
+         Store the result of running the program with the given fingerprint
+         on the n inputs in args, replacing any result stored for them
+         before. Failing to store it isn't an error; the result just isn't
+         cached.
+      **/
+   void Cache_Put (Cache *cache, unsigned long fingerprint, char **args, int n,
+                   Result *result);
+
+#endif
@@ -0,0 +1,159 @@
+
+// Headers.
+// ======================================================================
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "import.h"
+#include "parser.h"
+#include "typed_map.h"
+
+
+// Data structures.
+// ======================================================================
+
+   /**
+      A cached module.
+         mtime : modification time of the file it was parsed from.
+         prog : the finalised program, or NULL while it is being loaded.
+   **/
+struct module {
+   struct timespec mtime;
+   Program *prog;
+};
+
+   /**
+      Map from paths (interned in the cache's table) to modules.
+   **/
+MAP_DEFINE(ModuleMap, Str *, struct module, Str_Hash, Str_Same)
+
+   /**
+      The cache. Old versions of modules that changed on disk are kept in
+      retired until the cache is cleared.
+   **/
+static struct {
+   Arena *arena;
+   StrTable *paths;
+   ModuleMap *modules;
+   Program **retired;
+   int num_retired;
+} cache;
+
+
+
+// Private functions.
+// ======================================================================
+
+   /**
+      Find the file for the named module. Fills in path and st and
+      returns non-zero if it exists.
+   **/
+static int find_module (Str *name, char *dir, char *path, struct stat *st)
+{
+   static const char *exts[] = { ".tm", "" };
+   char *env = getenv("TURING_PATH");
+   const char *start = dir;
+   const char *end = dir + strlen(dir);
+   while (1) {
+      int len = end - start;
+      int e;
+      for (e=0; e < 2; e++) {
+         snprintf(path, PATH_MAX, "%.*s%s%s%s", len, start, len > 0 ? "/" : "",
+                  Str_Chars(name), exts[e]);
+         if (stat(path, st) == 0 && S_ISREG(st->st_mode))
+            return 1;
+      }
+
+      // Move on to the next directory on the search path.
+      if (env == NULL || *env == '\0')
+         return 0;
+      start = env;
+      end = strchr(env, ':');
+      if (end == NULL) end = env + strlen(env);
+      env = *end == ':' ? (char *)end + 1 : NULL;
+   }
+}
+
+static inline int same_time (struct timespec a, struct timespec b)
+{
+   return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+
+
+// Public functions.
+// ======================================================================
+
+int Import_Find (Str *name, char *dir, char *path)
+{
+   struct stat st;
+   return find_module(name, dir, path, &st);
+}
+
+Program *Import_Load (Str *name, char *dir, char *err, int err_len)
+{
+   if (cache.modules == NULL) {
+      cache.arena = Arena_Make();
+      cache.paths = StrTable_Make(cache.arena);
+      cache.modules = ModuleMap_Make(8);
+   }
+
+   // Find the file.
+   char path[PATH_MAX];
+   struct stat st;
+   if (!find_module(name, dir, path, &st)) {
+      if (err != NULL)
+         snprintf(err, err_len, "Could not find imported program '%s'.", Str_Chars(name));
+      return NULL;
+   }
+   Str *key = Str_InternChars(cache.paths, path, strlen(path));
+
+   // Use the cached program if the file hasn't changed.
+   struct module *found = ModuleMap_Get(cache.modules, key);
+   if (found != NULL) {
+      if (found->prog == NULL) {
+         if (err != NULL) snprintf(err, err_len, "Import cycle through %s.", path);
+         return NULL;
+      }
+      if (same_time(found->mtime, st.st_mtim))
+         return found->prog;
+      cache.retired = realloc(cache.retired, (cache.num_retired + 1) * sizeof(Program *));
+      cache.retired[cache.num_retired++] = found->prog;
+   }
+
+   // Parse it. It's marked as loading meanwhile, to catch cycles.
+   struct module loading = { st.st_mtim, NULL };
+   ModuleMap_Put(cache.modules, key, loading);
+   Program *prog = Parser_Load(path, 0, err, err_len);
+   if (prog == NULL) {
+      ModuleMap_Del(cache.modules, key);
+      return NULL;
+   }
+   struct module loaded = { st.st_mtim, prog };
+   ModuleMap_Put(cache.modules, key, loaded);
+   return prog;
+}
+
+void Import_Clear (void)
+{
+   if (cache.modules == NULL)
+      return;
+   int cursor = 0, i;
+   Str *path;
+   struct module *module;
+   while (ModuleMap_Next(cache.modules, &cursor, &path, &module)) {
+      if (module->prog != NULL) Prog_Free(module->prog);
+   }
+   for (i=0; i < cache.num_retired; i++) {
+      Prog_Free(cache.retired[i]);
+   }
+   ModuleMap_Free(cache.modules);
+   StrTable_Free(cache.paths);
+   Arena_Free(cache.arena);
+   free(cache.retired);
+   memset(&cache, 0, sizeof(cache));
+}
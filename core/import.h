@@ -0,0 +1,49 @@
+
+/* This module finds and loads the programs that other programs import. A
+   program names its imports in its header:
+
+      Imports: add, successor.
+
+   and each name is looked for as <name>.tm, then as <name> (a quintuple
+   program), first in the directory of the importing program and then in
+   each directory of the TURING_PATH environment variable (separated by
+   colons).
+
+   Every module is parsed once. The finalised program is cached under its
+   path and modification time and shared by everything that imports it, so
+   loading costs one parse per distinct module however many times it is
+   imported. A module that has changed on disk is parsed again the next time
+   it is imported; the old version stays alive, since programs loaded
+   earlier may still be using it. Cached programs belong to the cache and
+   are only freed by Import_Clear. */
+
+#ifndef IMPORT_H
+#define IMPORT_H
+
+   #include "program.h"
+
+   /**
+      Return the program imported by the given name from a program in
+      directory dir, loading it if it isn't cached. Returns NULL if it
+      can't be found or isn't a valid program, or if it is still being
+      loaded (an import cycle); the reason is written to err[0..err_len),
+      unless err is NULL. The cache isn't locked, so imports should only
+      be loaded from one thread at a time.
+   **/
+   Program *Import_Load (Str *name, char *dir, char *err, int err_len);
+
+   /**
+      Find the file that the given import of a program in directory dir
+      would be loaded from, without loading it. Writes its path to path,
+      which has room for PATH_MAX characters, and returns non-zero if
+      there is one.
+   **/
+   int Import_Find (Str *name, char *dir, char *path);
+
+   /**
+      Free every cached program. Nothing loaded before this may be used
+      afterwards, including programs that import cached ones.
+   **/
+   void Import_Clear (void);
+
+#endif
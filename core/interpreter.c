@@ -5,7 +5,8 @@ int
 I_Halted (struct machine *m, Program *prog)
 {
    Str *state = M_State(m);
-   int hasHalted = state == NULL || Str_EqIgnoreCase(state, "halt");
+   if (state == NULL) return 1;
+   int hasHalted = Str_EqIgnoreCase(state, "halt");
    Str_Free(state);
    return hasHalted;
 }
@@ -25,7 +26,6 @@ I_Step (Machine *m, Program *prog)
    // Perform instruction.
    switch (instr.action) {
       case M_ERR:
-         state = NULL;
          break;
       case M_LEFT:
          M_MvLeft(m);
@@ -36,9 +36,18 @@ I_Step (Machine *m, Program *prog)
       case M_PRINT:
          M_Write(m, instr.output);
          break;
+      case M_PRINT_LEFT:
+         M_Write(m, instr.output);
+         M_MvLeft(m);
+         break;
+      case M_PRINT_RIGHT:
+         M_Write(m, instr.output);
+         M_MvRight(m);
+         break;
    }
-   // Look up and perform transition. Free memory.
-   if (state != NULL) M_NextState(m, prog, input); 
+   // Look up and perform transition. Free memory. If there was no
+   // instruction there's no transition either, so the machine errors out.
+   M_NextState(m, prog, input);
    Str_Free(state);
 
 }
@@ -0,0 +1,324 @@
+
+// Headers.
+// ======================================================================
+
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "library.h"
+#include "import.h"
+#include "parser.h"
+#include "typed_map.h"
+
+
+
+// Data structures.
+// ======================================================================
+
+   /**
+      Where a file is in resolving its imports.
+   **/
+typedef enum { UNRESOLVED, RESOLVING, RESOLVED } Mark;
+
+   /**
+      A file of the library.
+         path : its path, as given.
+         prog : its program, or NULL if it didn't load.
+         err : why it didn't load.
+         seconds : time spent loading it.
+         mark : where it is in resolving its imports.
+   **/
+struct entry {
+   char *path;
+   Program *prog;
+   char err[PARSE_ERR_MAX];
+   double seconds;
+   Mark mark;
+};
+
+   /**
+      Map from real paths (interned in the library's table) to the files
+      they belong to.
+   **/
+MAP_DEFINE(EntryMap, Str *, int, Str_Hash, Str_Same)
+
+   /**
+      The library. Workers take the next file to parse from next.
+   **/
+struct library {
+   struct entry *entries;
+   int n;
+   atomic_int next;
+   int threads;
+   double seconds;
+   Arena *arena;
+   StrTable *paths;
+   EntryMap *by_path;
+};
+
+
+
+// Private functions.
+// ======================================================================
+
+static double now (void)
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+   /**
+      Parse files until there are none left.
+   **/
+static void *worker (void *arg)
+{
+   struct library *lib = arg;
+   int i;
+   while ((i = atomic_fetch_add(&lib->next, 1)) < lib->n) {
+      struct entry *e = &lib->entries[i];
+      double start = now();
+      e->prog = Parser_Load(e->path, PARSE_DEFER, e->err, sizeof(e->err));
+      if (e->prog == NULL && e->err[0] == '\0')
+         snprintf(e->err, sizeof(e->err), "Could not open file.");
+      e->seconds = now() - start;
+   }
+   return NULL;
+}
+
+   /**
+      The file in the library at the given path, or NULL if there isn't one.
+   **/
+static struct entry *find_entry (struct library *lib, char *path)
+{
+   char real[PATH_MAX];
+   if (realpath(path, real) == NULL)
+      return NULL;
+   Str *key = Str_InternChars(lib->paths, real, strlen(real));
+   int *found = EntryMap_Get(lib->by_path, key);
+   return found == NULL ? NULL : &lib->entries[*found];
+}
+
+static int fail (struct entry *e)
+{
+   Prog_Free(e->prog);
+   e->prog = NULL;
+   e->mark = RESOLVED;
+   return 0;
+}
+
+   /**
+      Give the file's program its imports and finalise it, resolving the
+      files in the library it imports first. Returns non-zero if the
+      program is ready to use.
+   **/
+static int resolve (struct library *lib, struct entry *e)
+{
+   if (e->prog == NULL || e->mark == RESOLVED)
+      return e->prog != NULL;
+   if (Prog_IsFinalised(e->prog)) {
+      e->mark = RESOLVED;
+      return 1;
+   }
+   e->mark = RESOLVING;
+
+   // Imports are looked for next to the file, as the parser would.
+   char *slash = strrchr(e->path, '/');
+   int dir_len = slash == NULL ? 0 : slash - e->path;
+   char dir[dir_len + 1];
+   memcpy(dir, e->path, dir_len);
+   dir[dir_len] = '\0';
+
+   int i;
+   for (i=0; i < Prog_NumImports(e->prog); i++) {
+      Str *name = Prog_ImportName(e->prog, i);
+      char path[PATH_MAX];
+      struct entry *dep = Import_Find(name, dir, path) ? find_entry(lib, path) : NULL;
+      Program *module;
+      if (dep != NULL) {
+         if (dep->mark == RESOLVING) {
+            snprintf(e->err, sizeof(e->err), "Import cycle through %s.", dep->path);
+            return fail(e);
+         }
+         if (!resolve(lib, dep)) {
+            snprintf(e->err, sizeof(e->err), "Could not load imported program '%s'.",
+                     Str_Chars(name));
+            return fail(e);
+         }
+         module = dep->prog;
+      }
+      else {
+         double start = now();
+         module = Import_Load(name, dir, e->err, sizeof(e->err));
+         e->seconds += now() - start;
+         if (module == NULL)
+            return fail(e);
+      }
+      if (!Prog_SetImport(e->prog, i, module, e->err, sizeof(e->err)))
+         return fail(e);
+   }
+
+   double start = now();
+   int ok = Prog_Finalise(e->prog, e->err, sizeof(e->err));
+   e->seconds += now() - start;
+   if (!ok)
+      return fail(e);
+   e->mark = RESOLVED;
+   return 1;
+}
+
+static int cmp_names (const void *a, const void *b)
+{
+   return strcmp(*(char **)a, *(char **)b);
+}
+
+
+
+// Public functions.
+// ======================================================================
+
+Library *Lib_LoadFiles (char **paths, int n, int threads)
+{
+   double start = now();
+   struct library *lib = malloc(sizeof(struct library));
+   lib->entries = calloc(n > 0 ? n : 1, sizeof(struct entry));
+   lib->n = n;
+   atomic_init(&lib->next, 0);
+   lib->arena = Arena_Make();
+   lib->paths = StrTable_Make(lib->arena);
+   lib->by_path = EntryMap_Make(n > 0 ? n : 1);
+
+   // Note where every file really is, so imports can find them.
+   int i;
+   for (i=0; i < n; i++) {
+      lib->entries[i].path = strdup(paths[i]);
+      lib->entries[i].mark = UNRESOLVED;
+      char real[PATH_MAX];
+      if (realpath(paths[i], real) != NULL)
+         EntryMap_Put(lib->by_path, Str_InternChars(lib->paths, real, strlen(real)), i);
+   }
+
+   // Parse them all on the pool. The calling thread is one of the workers.
+   if (threads <= 0)
+      threads = sysconf(_SC_NPROCESSORS_ONLN);
+   if (threads > n)
+      threads = n;
+   if (threads < 1)
+      threads = 1;
+   lib->threads = threads;
+   pthread_t pool[threads];
+   int started = 0;
+   for (i=1; i < threads; i++) {
+      if (pthread_create(&pool[started], NULL, worker, lib) == 0)
+         started++;
+   }
+   worker(lib);
+   for (i=0; i < started; i++) {
+      pthread_join(pool[i], NULL);
+   }
+
+   // Then join them up.
+   for (i=0; i < n; i++) {
+      resolve(lib, &lib->entries[i]);
+   }
+   lib->seconds = now() - start;
+   return lib;
+}
+
+Library *Lib_LoadDir (char *dir, int threads)
+{
+   DIR *d = opendir(dir);
+   if (d == NULL)
+      return NULL;
+
+   // Gather the names of the files.
+   char **paths = NULL;
+   int n = 0;
+   struct dirent *ent;
+   while ((ent = readdir(d)) != NULL) {
+      if (ent->d_name[0] == '.') continue;
+      if (ent->d_type != DT_REG && ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN)
+         continue;
+      int len = strlen(dir) + strlen(ent->d_name) + 2;
+      char *path = malloc(len);
+      snprintf(path, len, "%s/%s", dir, ent->d_name);
+      paths = realloc(paths, (n + 1) * sizeof(char *));
+      paths[n++] = path;
+   }
+   closedir(d);
+   qsort(paths, n, sizeof(char *), cmp_names);
+
+   Library *lib = Lib_LoadFiles(paths, n, threads);
+   int i;
+   for (i=0; i < n; i++) {
+      free(paths[i]);
+   }
+   free(paths);
+   return lib;
+}
+
+void Lib_Free (Library *lib)
+{
+   int i;
+   for (i=0; i < lib->n; i++) {
+      if (lib->entries[i].prog != NULL) Prog_Free(lib->entries[i].prog);
+      free(lib->entries[i].path);
+   }
+   free(lib->entries);
+   EntryMap_Free(lib->by_path);
+   StrTable_Free(lib->paths);
+   Arena_Free(lib->arena);
+   free(lib);
+}
+
+int Lib_Size (Library *lib)
+{
+   return lib->n;
+}
+
+char *Lib_Path (Library *lib, int i)
+{
+   return lib->entries[i].path;
+}
+
+Program *Lib_Program (Library *lib, int i)
+{
+   return lib->entries[i].prog;
+}
+
+char *Lib_Error (Library *lib, int i)
+{
+   return lib->entries[i].prog == NULL ? lib->entries[i].err : NULL;
+}
+
+double Lib_LoadTime (Library *lib, int i)
+{
+   return lib->entries[i].seconds;
+}
+
+void Lib_Summary (Library *lib, FILE *out)
+{
+   int loaded = 0, i;
+   double total = 0;
+   for (i=0; i < lib->n; i++) {
+      struct entry *e = &lib->entries[i];
+      fprintf(out, "%10.3f ms  %s\n", e->seconds * 1e3, e->path);
+      if (e->prog == NULL)
+         fprintf(out, "              error: %s\n", e->err);
+      else if (e->err[0] != '\0')
+         fprintf(out, "              warning: %s\n", e->err);
+      if (e->prog != NULL)
+         loaded++;
+      total += e->seconds;
+   }
+   fprintf(out, "Loaded %d of %d programs in %.3f ms on %d thread%s "
+                "(%.3f ms spent on files).\n",
+           loaded, lib->n, lib->seconds * 1e3, lib->threads,
+           lib->threads == 1 ? "" : "s", total * 1e3);
+}
@@ -0,0 +1,60 @@
+
+/* This module loads a library of programs: every file in a directory, or a
+   given list of files. The files are parsed at the same time on a pool of
+   threads, with their imports left unresolved. Once everything has been
+   parsed, the imports are resolved on the calling thread: an import naming
+   a program in the library gets that program, and any other import is
+   loaded through the import cache (see import.h). A file that isn't a valid
+   program doesn't stop the others loading; its error is kept instead.
+
+   The time taken over each file (parsing it, then resolving its imports and
+   finalising it) is recorded, so slow loads can be pinned on their files. */
+
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+   #include <stdio.h>
+
+   #include "program.h"
+
+   typedef struct library Library;
+
+      /**
+         Load every file in dir (except hidden ones), or the n files in
+         paths, on the given number of threads. If threads is 0 or less,
+         there is one per processor. Returns NULL if dir can't be read.
+      **/
+   Library *Lib_LoadDir (char *dir, int threads);
+   Library *Lib_LoadFiles (char **paths, int n, int threads);
+
+      /**
+         Free the library and its programs. The programs may import
+         modules from the import cache, so this has to come before
+         Import_Clear.
+      **/
+   void Lib_Free (Library *lib);
+
+      /**
+         These functions describe the files in the library, which are
+         numbered [0, Lib_Size) in the order they were given (directories
+         are listed in name order).
+            Lib_Path : the path of file i.
+            Lib_Program : the finalised program in file i, or NULL if it
+               didn't load. The program belongs to the library.
+            Lib_Error : why file i didn't load, or NULL if it did.
+            Lib_LoadTime : seconds spent loading file i.
+      **/
+   int Lib_Size (Library *lib);
+   char *Lib_Path (Library *lib, int i);
+   Program *Lib_Program (Library *lib, int i);
+   char *Lib_Error (Library *lib, int i);
+   double Lib_LoadTime (Library *lib, int i);
+
+      /**
+         Print the load time of each file (and the error of each that
+         didn't load, or any warning about one that did) to out, followed
+         by totals.
+      **/
+   void Lib_Summary (Library *lib, FILE *out);
+
+#endif
@@ -1,30 +1,161 @@
 
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "machine.h"
-
-#define TAPE_SIZE 100
+#include "simd.h"
 
 #define CHAR_CODE_BLANK 32
 #define CHAR_CODE_1 49
 
-struct tape {
-   char *cells;
-   struct tape *prev;
-   struct tape *next;
-};
+#define DECODE_BLOCK 65536
 
 /** This is the internal representation of a machine.
-    It's basically a linked list that grows in size
-    when it needs to. **/
+    The head is an absolute position on the tape; the
+    tape itself grows when it needs to. The hash of the
+    configuration is kept up to date as the machine runs. **/
 struct machine {
-   int head;
+   long head;
    Str *state;
-   struct tape *leftmost;
-   struct tape *current;
+   Tape *tape;
+   unsigned long hash;
 };
 
-struct tape *Tape_Make (void);
-void Tape_Del (struct tape *);
+
+
+// Configuration hashing.
+// ============================================================
+
+// The hash is a Zobrist hash: the XOR of a key for every non-blank cell
+// (picked by its position and symbol), a key for the head position and a key
+// for the state. Changing any one of these only takes two XORs to undo the
+// old key and apply the new one. The keys come from splitmix64 rather than a
+// table, since the tape is unbounded.
+
+#define HEAD_SEED 0x9E3779B97F4A7C15UL
+#define STATE_SEED 0xC2B2AE3D27D4EB4FUL
+
+static inline unsigned long
+mix (unsigned long x)
+{
+   x += 0x9E3779B97F4A7C15UL;
+   x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9UL;
+   x = (x ^ (x >> 27)) * 0x94D049BB133111EBUL;
+   return x ^ (x >> 31);
+}
+
+   /**
+      The key for symbol c sitting at pos. Blanks don't contribute, so an
+      untouched tape hashes to 0 however big it is.
+   **/
+static inline unsigned long
+cell_key (long pos, char c)
+{
+   if (c == BLANK) return 0;
+   return mix(((unsigned long)pos << 8) | (unsigned char)c);
+}
+
+static inline unsigned long
+head_key (long head)
+{
+   return mix((unsigned long)head ^ HEAD_SEED);
+}
+
+static inline unsigned long
+state_key (Str *state)
+{
+   if (state == NULL) return 0;
+   return mix(Str_Hash(state) ^ STATE_SEED);
+}
+
+   /**
+      Hash the whole written region of the tape. This is only needed when a
+      machine is made over a tape that already has something on it.
+   **/
+static unsigned long
+tape_key (Tape *tape)
+{
+   long lo, hi;
+   Tape_Extent(tape, &lo, &hi);
+   char *block = malloc(DECODE_BLOCK);
+   unsigned long key = 0;
+   while (lo < hi) {
+      long n = hi - lo < DECODE_BLOCK ? hi - lo : DECODE_BLOCK;
+      Tape_ReadRange(tape, lo, n, block);
+      long i = Simd_Find(block, n, BLANK, 0);
+      while (i < n) {
+         key ^= cell_key(lo + i, block[i]);
+         i++;
+         i += Simd_Find(block + i, n - i, BLANK, 0);
+      }
+      lo += n;
+   }
+   free(block);
+   return key;
+}
+
+
+
+// Writing inputs.
+// ============================================================
+
+   /**
+      Write a single input onto the tape at pos, in the given encoding.
+      Returns the number of cells written, or -1 if the input isn't valid.
+   **/
+static long
+write_input (Tape *tape, long pos, Encoding encoding, char *arg)
+{
+
+   // Symbols go on the tape exactly as they are.
+   long len = strlen(arg);
+   if (encoding == ENC_SYMBOLS) {
+      Tape_WriteRange(tape, pos, len, arg);
+      return len;
+   }
+
+   // Everything else is a number.
+   unsigned long n = 0;
+   long i;
+   if (len == 0)
+      return -1;
+   for (i=0; i < len; i++) {
+      if (!isdigit(arg[i]) || n > (LONG_MAX - 9) / 10)
+         return -1;
+      n = n * 10 + (arg[i] - '0');
+   }
+
+   char digits[64];
+   switch (encoding) {
+      case ENC_UNARY:
+         Tape_Fill(tape, pos, n, CHAR_CODE_1);
+         return n;
+      case ENC_DECIMAL:
+         len = snprintf(digits, sizeof(digits), "%lu", n);
+         break;
+      case ENC_BINARY:
+         len = 0;
+         do {
+            digits[len++] = '0' + (n & 1);
+            n >>= 1;
+         } while (n > 0);
+         for (i=0; i < len/2; i++) {
+            char c = digits[i];
+            digits[i] = digits[len - 1 - i];
+            digits[len - 1 - i] = c;
+         }
+         break;
+      default:
+         return -1;
+   }
+   Tape_WriteRange(tape, pos, len, digits);
+   return len;
+
+}
 
 
 
@@ -34,142 +165,241 @@ void Tape_Del (struct tape *);
 struct machine *
 M_Make (Program *prog, int *inputs)
 {
+   return M_MakeOn(prog, inputs, Tape_MakeChunked());
+}
 
-   // Make the struct representing the machine.
-   struct machine *m = malloc(sizeof (struct machine));
-   m->head = (int) (TAPE_SIZE/2); // Put in middle of tape.
-   m->leftmost = Tape_Make();
-   m->current = m->leftmost;
-   m->state = Prog_InitState(prog);
+struct machine *
+M_MakeOn (Program *prog, int *inputs, Tape *tape)
+{
 
-   // Write the inputs to the tape.
+   // Write the inputs out as strings. A program that takes any number of
+   // inputs gets none.
    int num_inputs = Prog_NumInputs(prog);
+   if (num_inputs < 0) num_inputs = 0;
+   char digits[num_inputs + 1][16];
+   char *args[num_inputs + 1];
    int i;
    for (i=0; i < num_inputs; i++) {
-      int k;
-      for (k=0; k < inputs[i]; k++) {
-         M_Write(m, CHAR_CODE_1);
-         M_MvRight(m);
+      snprintf(digits[i], sizeof(digits[i]), "%d", inputs[i] < 0 ? 0 : inputs[i]);
+      args[i] = digits[i];
+   }
+
+   return M_MakeFromArgs(prog, args, num_inputs, tape);
+
+}
+
+struct machine *
+M_MakeFromArgs (Program *prog, char **args, int num_args, Tape *tape)
+{
+
+   // Write the inputs to the tape, with a blank after each.
+   Encoding encoding = Prog_Encoding(prog);
+   long pos = 0;
+   int i;
+   for (i=0; i < num_args; i++) {
+      long written = write_input(tape, pos, encoding, args[i]);
+      if (written < 0) {
+         Tape_Del(tape);
+         return NULL;
       }
-      M_MvRight(m);
+      pos += written + 1;
+   }
+
+   return M_MakeFromTape(prog, tape);
+
+}
+
+struct machine *
+M_MakeFromImage (Program *prog, char *path, Tape *tape)
+{
+
+   // Map the file, then copy it onto the tape in one go.
+   int fd = open(path, O_RDONLY);
+   struct stat st;
+   if (fd == -1 || fstat(fd, &st) == -1)
+      goto err;
+   if (st.st_size > 0) {
+      char *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (image == MAP_FAILED)
+         goto err;
+      Tape_WriteRange(tape, 0, st.st_size, image);
+      munmap(image, st.st_size);
    }
+   close(fd);
+   return M_MakeFromTape(prog, tape);
+
+   err:
+      if (fd != -1) close(fd);
+      Tape_Del(tape);
+      return NULL;
+
+}
 
-   // Reset the head, clean up.
-   m->current = m->leftmost;
-   m->head = (int) (TAPE_SIZE/2);
+struct machine *
+M_MakeFromTape (Program *prog, Tape *tape)
+{
+   struct machine *m = malloc(sizeof (struct machine));
+   m->head = 0;
+   m->tape = tape;
+   m->state = Prog_InitState(prog);
+   m->hash = tape_key(tape) ^ head_key(0) ^ state_key(m->state);
    return m;
 }
 
 void
 M_Del (struct machine *m)
 {
-  
-   // First free all the tapes in this machine.
-   struct tape *tape = m->leftmost;
-   while (tape != NULL) {
-      struct tape *next = tape->next;
-      Tape_Del(tape);
-      tape = next;
-   }
-
-   // Then free the machine.
-   m->leftmost = NULL;
-   m->current = NULL;
+   Tape_Del(m->tape);
+   m->tape = NULL;
    free(m);
-
 }
 
-struct tape *
-Tape_Make () {
-   struct tape *tape = malloc(sizeof (struct tape));
-   tape->prev = NULL;
-   tape->next = NULL;
-   tape->cells = malloc(sizeof(char) * TAPE_SIZE);
-   int i;
-   for (i = 0; i < TAPE_SIZE; i++) {
-      tape->cells[i] = CHAR_CODE_BLANK;
-   }
-   return tape;
+struct machine *
+M_Fork (struct machine *m)
+{
+   struct machine *fork = malloc(sizeof (struct machine));
+   fork->head = m->head;
+   fork->state = m->state == NULL ? NULL : Str_Copy(m->state);
+   fork->tape = Tape_Fork(m->tape);
+   fork->hash = m->hash;
+   return fork;
 }
 
 void
-Tape_Del (struct tape *tape) {
-   tape->prev = NULL;
-   tape->next = NULL;
-   free(tape->cells);
-   free(tape);
+M_Sync (struct machine *m)
+{
+   Tape_Sync(m->tape);
 }
 
 char
 M_CharAtHead (struct machine *m, int offset)
 {
-   struct tape *current = m->current;
-   int myhead = m->head;
+   return Tape_Read(m->tape, m->head + offset);
+}
+
+long
+M_Head (struct machine *m)
+{
+   return m->head;
+}
 
-   while (offset != 0) {
+void
+M_ReadRange (struct machine *m, long start, long len, char *buf)
+{
+   Tape_ReadRange(m->tape, start, len, buf);
+}
 
-      // Symbol is left of head.
-      if (offset < 0) {
-         
-         // Move onto next tape to the left.
-         if (myhead == 0) {
-            if (current->prev == NULL) {
-               return CHAR_CODE_BLANK;
+void
+M_Extent (struct machine *m, long *lo, long *hi)
+{
+   Tape_Extent(m->tape, lo, hi);
+}
+
+long
+M_Count (struct machine *m, char c)
+{
+   long lo, hi;
+   Tape_Extent(m->tape, &lo, &hi);
+   return Tape_Count(m->tape, lo, hi, c);
+}
+
+long
+M_DecodeUnary (struct machine *m, long *nums, long max)
+{
+   long lo, hi;
+   Tape_Extent(m->tape, &lo, &hi);
+
+   // Read the tape a block at a time, jumping between the ends of runs.
+   char *block = malloc(DECODE_BLOCK);
+   long found = 0;
+   long run = 0; // length of the run we're in, which may span blocks.
+   while (lo < hi) {
+      long n = hi - lo < DECODE_BLOCK ? hi - lo : DECODE_BLOCK;
+      Tape_ReadRange(m->tape, lo, n, block);
+
+      long i = 0;
+      while (i < n) {
+         if (run == 0) {
+            i += Simd_Find(block + i, n - i, CHAR_CODE_1, 1);
+            if (i < n) {
+               run = 1;
+               i++;
             }
-            else {
-               current = current->prev;
-               myhead = TAPE_SIZE - 1;      
-               offset--;      
-            }       
+            continue;
          }
-  
-         // Else move left one.
-         else {
-            myhead--;
-            offset--;
+         long k = Simd_Find(block + i, n - i, CHAR_CODE_1, 0);
+         run += k;
+         i += k;
+         if (i < n) {
+            if (found < max) nums[found] = run;
+            found++;
+            run = 0;
          }
       }
+      lo += n;
+   }
+   if (run > 0) {
+      if (found < max) nums[found] = run;
+      found++;
+   }
 
-      // Symbol is right of head.
-      else {
-         
-         // Move onto next tape to the right.
-         if (myhead == TAPE_SIZE - 1) {
-            if (current->next == NULL) {
-               return CHAR_CODE_BLANK;
-            }
-            else {
-               current = current->next;
-               myhead = 0;
-               offset--;
-            }         
-         }
+   free(block);
+   return found;
+}
 
-         // Else move right one.
-         else {
-            myhead++;
-            offset--;
-         }
+int
+M_Export (struct machine *m, int fd)
+{
+   long lo, hi;
+   Tape_Extent(m->tape, &lo, &hi);
+   return Tape_Export(m->tape, lo, hi, fd);
+}
 
-      }
-   }
+unsigned long
+M_Hash (struct machine *m)
+{
+   return m->hash;
+}
 
-   return current->cells[myhead];
+unsigned long
+M_TapeHash (struct machine *m)
+{
+   return m->hash ^ state_key(m->state);
+}
 
+unsigned long
+M_StateHash (Str *state)
+{
+   return state_key(state);
 }
 
 void
 M_NextState (Machine *m, Program *prog, char input)
 {
    if (m->state == NULL) return;
+   Str *next = Prog_NextTransition(prog, m->state, input);
+   m->hash ^= state_key(m->state) ^ state_key(next);
    Str_Free(m->state);
-   m->state = Prog_NextTransition(prog, m->state, input);
+   m->state = next;
+}
+
+int
+M_Rebind (Machine *m, Program *old, Program *prog)
+{
+   if (m->state == NULL) return 1;
+   Str *state = Prog_FindState(prog, m->state);
+   if (Prog_IsStateDefined(old, m->state) && !Prog_IsStateDefined(prog, state))
+      return 0;
+
+   // The name is the same, so the hash doesn't change.
+   m->state = state;
+   return 1;
 }
 
 Str *
 M_State (Machine *m)
 {
-   return Str_Copy(m->state);
+   return m->state == NULL ? NULL : Str_Copy(m->state);
 }
 
 
@@ -178,36 +408,24 @@ M_State (Machine *m)
 
 void
 M_Write (struct machine *m, char c) {
-   int head = m->head;
-   (m->current->cells)[head] = c;
+   char old = Tape_Read(m->tape, m->head);
+   m->hash ^= cell_key(m->head, old) ^ cell_key(m->head, c);
+   Tape_Write(m->tape, m->head, c);
 }
 
 char
 M_Read (struct machine *m) {
-   int head = m->head;
-   return (m->current->cells)[head];
+   return Tape_Read(m->tape, m->head);
 }
 
 void
 M_MvRight (struct machine *m) {
-   int head = (m->head + 1) % TAPE_SIZE;
-   if (head == 0) {
-      struct tape *next_tape = Tape_Make();
-      m->current->next = next_tape;
-      m->current = next_tape;
-   }
-   m->head = head;
+   m->hash ^= head_key(m->head) ^ head_key(m->head + 1);
+   m->head++;
 }
 
 void
 M_MvLeft (struct machine *m) {
-   int head = (m->head - 1) % TAPE_SIZE;
-   if (head == -1) {
-      head = TAPE_SIZE - 1; // Wrap around to end.
-      struct tape *prev_tape = Tape_Make();
-      m->current->prev = prev_tape;
-      m->current = prev_tape;
-   }
-   m->head = head;
+   m->hash ^= head_key(m->head) ^ head_key(m->head - 1);
+   m->head--;
 }
-
@@ -9,10 +9,9 @@
 
    #include "action.h"
    #include "program.h"
+   #include "tape.h"
    #include "stdlib.h"
 
-   #define BLANK 32
-
    typedef struct machine Machine;
 
       /** These are basic instructions that a machine can execute. They map to the
@@ -24,9 +23,73 @@
    Machine *M_Make (Program *prog, int *inputs);
    void M_Del (Machine *m);
 
+      /** Make a machine which stores its tape in the given tape backend
+          (see tape.h). The machine takes ownership of the tape and frees
+          it in M_Del. M_Make is the same as using a chunked tape. The
+          inputs are written in the program's encoding (see program.h);
+          negative inputs are treated as 0. A program that takes any
+          number of inputs (PROG_ANY_INPUTS) is given none. **/
+   Machine *M_MakeOn (Program *prog, int *inputs, Tape *tape);
+
+      /** Make a machine whose num_args inputs are given as strings, e.g.
+          from the command line. Numbers can be as large as the tape allows.
+          Returns a null pointer (and frees the tape) if an input isn't
+          valid for the program's encoding. **/
+   Machine *M_MakeFromArgs (Program *prog, char **args, int num_args, Tape *tape);
+
+      /** Make a machine whose tape is loaded from a file. Each byte of the
+          file is one cell, starting at the head. Returns a null pointer
+          (and frees the tape) if the file can't be read. **/
+   Machine *M_MakeFromImage (Program *prog, char *path, Tape *tape);
+
+      /** Make a machine over a tape that already holds its input, such as
+          one opened with Tape_OpenMapped. **/
+   Machine *M_MakeFromTape (Program *prog, Tape *tape);
+
+      /** Reading results off the tape, normally after the machine halts.
+          These all look at the region of tape that has been written to
+          (see M_Extent) and work on the tape's storage directly.
+             M_Count : the number of cells holding c.
+             M_DecodeUnary : the lengths of the runs of 1s, in order. Up to
+                max of them are stored in nums, and the total number of runs
+                is returned.
+             M_Export : write the region to the file descriptor fd. Returns
+                0 on success and -1 on an IO error. **/
+   long M_Count (Machine *m, char c);
+   long M_DecodeUnary (Machine *m, long *nums, long max);
+   int M_Export (Machine *m, int fd);
+
+      /** Return an independent copy of the machine: same state, head and
+          tape contents. The copy shares tape storage copy-on-write where the
+          tape backend allows it, so forking a chunked machine is O(1). Both
+          machines must be freed with M_Del. **/
+   Machine *M_Fork (Machine *m);
+
+      /** Return a hash of the machine's configuration: its state, head
+          position and tape contents. Machines in the same configuration
+          have the same hash, whichever tape backend they use. The hash is
+          updated as the machine runs, so this is O(1); making a machine
+          over a tape that already holds n cells costs O(n) to hash them. **/
+   unsigned long M_Hash (Machine *m);
+
+      /** The hash is the XOR of a part for the tape and head, which
+          M_TapeHash returns, and a part for the state, which
+          M_StateHash gives for any state (or NULL). **/
+   unsigned long M_TapeHash (Machine *m);
+   unsigned long M_StateHash (Str *state);
+
+      /** Flush the machine's tape to its backing store, if it has one. **/
+   void M_Sync (Machine *m);
+
       /** Update machine state. **/
    void M_NextState (Machine *m, Program *prog, char input);
    
+      /** Move the machine over to prog, a new version of old, the program
+          it has been running. The tape and head stay as they are. Returns
+          0, leaving the machine alone, if the machine is in a state that
+          old defines and prog doesn't. **/
+   int M_Rebind (Machine *m, Program *old, Program *prog);
+
       /** Return a copy of the machine's state. **/
    Str *M_State (Machine *m);
 
@@ -46,6 +109,19 @@
       /** Get the symbol on the tape at the head, with the specified offset. **/
    char M_CharAtHead (Machine *m, int offset);
 
+      /** Return the absolute position of the head. The head starts at
+          position 0, at the start of the first input. **/
+   long M_Head (Machine *m);
+
+      /** Copy len cells of tape into buf, starting from the absolute position
+          start. For a window relative to the head, use M_Head(m) + offset as
+          the start. Costs O(len) wherever the window is. **/
+   void M_ReadRange (Machine *m, long start, long len, char *buf);
+
+      /** Get the region of tape that has been written to, as the absolute
+          positions [lo, hi). Every cell outside it is blank. **/
+   void M_Extent (Machine *m, long *lo, long *hi);
+
 
 
 
@@ -9,10 +9,11 @@ Here is the grammar.
 
 PROGRAM     ::= HEADER [DEFINITION]+
 
-HEADER      ::= NAME INPUTS INITIAL [IMPORTS]?
+HEADER      ::= NAME INPUTS INITIAL [ENCODING]? [IMPORTS]?
 NAME        ::= Routine: IDEN.
 INPUTS      ::= Inputs: NUMBER.
 INITIAL     ::= Init: IDEN.
+ENCODING    ::= Encoding: [unary | binary | decimal | symbols].
 IMPORTS     ::= Imports: [IDEN]+ [,IDEN]*.
 
 DEFINITION  ::= IDEN: [CLAUSE]+ 
@@ -37,71 +38,117 @@ NUMBER      ::= [0-9]+
 
 #include "parser.h"
 
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "simd.h"
+#include "quintuple.h"
+#include "import.h"
+
 
 // Some handy macros.
 // ======================================================================
 
 #define SKIP skip_whitespace(data)
 
-#define ERR(...) do {\
-   fprintf(stderr, __VA_ARGS__);\
-   fprintf(stderr, "\n");\
-   abort();\
-} while(0)
+#define ERR(...) fail(data, __VA_ARGS__)
 
 #define TERMINATOR do {\
    if (!gobble_char(data, '.'))\
-      ERR("Missing '.' terminator");\
+      ERR("Missing '.' terminator on line %d.", data->line_num);\
 } while(0)
 
 #define COLON do {\
    if (!gobble_char(data, ':'))\
-      ERR("Missing ':'");\
+      ERR("Missing ':' on line %d.", data->line_num);\
 } while(0)
 
 #define ARROW do {\
    if (!gobble_token(data, "->"))\
-      ERR("Missing '->'");\
+      ERR("Missing '->' on line %d.", data->line_num);\
 } while(0)
 
 #define COMMA do {\
    if (!gobble_char(data, ','))\
-      ERR("Missing ','");\
+      ERR("Missing ',' on line %d.", data->line_num);\
 } while(0)
 
 #define DONE done(data)
 
+// For printing a token with printf's "%.*s".
+#define TOK(t) (t).len, (t).chars
+
 
 // Definitions.
 // ======================================================================
 
+   /**
+      The text being parsed isn't copied: it may be a file mapped into
+      memory, so it needn't be null-terminated and the lexer never reads
+      past len. Tokens are views into it. Names are only copied when they
+      are interned with the program. The clauses of the state being
+      parsed are gathered in inputs, instrs and end_states, which have
+      room for capacity clauses. Imports are looked for relative to dir,
+      the directory of the file being parsed, unless flags has
+      PARSE_DEFER. Errors jump back to bail, having written their message
+      to err.
+   **/
 struct parse_data {
    char *text;
-   int index;
-   int len;
+   char *dir;
+   int flags;
+   long index;
+   long len;
    int line_num;
    Program *prog;
+   char *inputs;
+   Instruction *instrs;
+   Str **end_states;
+   int capacity;
+   jmp_buf bail;
+   char *err;
+   int err_len;
 };
 
 typedef struct parse_data DATA;
 
+   /**
+      A token: len characters of the text, starting at chars.
+   **/
+struct token {
+   char *chars;
+   int len;
+};
+
+typedef struct token Token;
+
 
 
 // Function definitions.
 // ======================================================================
 
+// Lexing.
+static inline long scan_space (const char *p, long n, int *lines);
+static inline long scan_token (const char *p, long n);
+
 // Parsing helpers.
 static inline int is_delim (char c);
-static inline int is_number (Str *string);
+static inline char peek (DATA *data, long offset);
 static inline int done (DATA *data);
 static inline void skip_whitespace (DATA *data);
 static inline int gobble_char (DATA *data, char c);
-static inline int gobble_str (DATA *data, char *s);
+static inline int gobble_token (DATA *data, char *s);
 static inline int gobble_str_insensitive(DATA *data, char *s);
 
-static inline Str *parse_line (DATA *);
-static inline Str *parse_string (DATA *);
-static inline Str *peek_string (DATA *);
+static inline int tok_eq (Token tok, char *s);
+static inline int tok_eq_ignore_case (Token tok, char *s);
+static inline Str *tok_intern (DATA *data, Token tok);
+static inline Token parse_string (DATA *);
+static inline Token peek_string (DATA *);
+static inline int peek_keyword (DATA *, char *);
 static inline int parse_number (DATA *);
 
 // Parsing grammar rules.
@@ -109,26 +156,124 @@ static inline void Parse_Header (DATA *);
 static inline void Parse_Name (DATA *);
 static inline void Parse_Inputs (DATA *);
 static inline void Parse_InitState (DATA *);
+static inline void Parse_Encoding (DATA *);
+static inline void Parse_Imports (DATA *);
 static inline void Parse_States (DATA *);
 static inline void Parse_State (DATA *);
-static inline void Parse_Clause (DATA *data, int index, char *inputs,
-                                 Instruction *instrs, Str **end_states);
+static inline void Parse_Clause (DATA *data, Token input, int index);
+static void grow_clauses (DATA *);
+static Program *parse_text (char *text, long len, char *name, char *dir,
+                            int flags, char *err, int err_len);
+static _Noreturn void fail (DATA *data, char *fmt, ...);
+
+
+// Lexing.
+// ======================================================================
+
+// The lexer classifies a register's worth of bytes at once with AVX2 or SSE2
+// compares (when the compiler targets them), turning each class into a
+// bitmask with one bit per byte. The first set bit of a mask is where a token
+// or run of whitespace ends, and counting the newline bits before it keeps
+// line_num right. Whitespace is what isspace accepts in the C locale: space
+// and '\t' to '\r'.
+
+#if defined(__AVX2__)
+#define LEX_WIDTH 32
+#define LEX_ALL 0xFFFFFFFFu
+typedef __m256i lex_vec;
+#define LEX_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define LEX_SET(c) _mm256_set1_epi8(c)
+#define LEX_EQ(a, b) _mm256_cmpeq_epi8(a, b)
+#define LEX_GT(a, b) _mm256_cmpgt_epi8(a, b)
+#define LEX_OR(a, b) _mm256_or_si256(a, b)
+#define LEX_AND(a, b) _mm256_and_si256(a, b)
+#define LEX_MASK(a) ((unsigned int)_mm256_movemask_epi8(a))
+#elif defined(__SSE2__)
+#define LEX_WIDTH 16
+#define LEX_ALL 0xFFFFu
+typedef __m128i lex_vec;
+#define LEX_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define LEX_SET(c) _mm_set1_epi8(c)
+#define LEX_EQ(a, b) _mm_cmpeq_epi8(a, b)
+#define LEX_GT(a, b) _mm_cmpgt_epi8(a, b)
+#define LEX_OR(a, b) _mm_or_si128(a, b)
+#define LEX_AND(a, b) _mm_and_si128(a, b)
+#define LEX_MASK(a) ((unsigned int)_mm_movemask_epi8(a))
+#endif
+
+#ifdef LEX_WIDTH
+static inline lex_vec lex_space (lex_vec v)
+{
+   lex_vec ctrl = LEX_AND(LEX_GT(v, LEX_SET('\t' - 1)), LEX_GT(LEX_SET('\r' + 1), v));
+   return LEX_OR(ctrl, LEX_EQ(v, LEX_SET(' ')));
+}
+#endif
+
+   /**
+      Return the length of the run of whitespace at the start of p[0..n),
+      adding the number of line breaks in it to *lines.
+   **/
+static inline long scan_space (const char *p, long n, int *lines)
+{
+   long i = 0;
+#ifdef LEX_WIDTH
+   for (; n - i >= LEX_WIDTH; i += LEX_WIDTH) {
+      lex_vec v = LEX_LOAD(p + i);
+      unsigned int stop = LEX_MASK(lex_space(v)) ^ LEX_ALL;
+      unsigned int breaks = LEX_MASK(LEX_OR(LEX_EQ(v, LEX_SET('\n')),
+                                            LEX_EQ(v, LEX_SET('\r'))));
+      if (stop != 0) {
+         unsigned int before = (1u << __builtin_ctz(stop)) - 1;
+         *lines += __builtin_popcount(breaks & before);
+         return i + __builtin_ctz(stop);
+      }
+      *lines += __builtin_popcount(breaks);
+   }
+#endif
+   for (; i < n && isspace(p[i]); i++) {
+      if (p[i] == '\r' || p[i] == '\n')
+         (*lines)++;
+   }
+   return i;
+}
 
-// Static analysis - should this move to a separate module?
-static inline int count_states (DATA *);
-static inline int count_clauses (DATA *);
+   /**
+      Return the length of the token at the start of p[0..n): everything up
+      to the first delimiter.
+   **/
+static inline long scan_token (const char *p, long n)
+{
+   long i = 0;
+#ifdef LEX_WIDTH
+   for (; n - i >= LEX_WIDTH; i += LEX_WIDTH) {
+      lex_vec v = LEX_LOAD(p + i);
+      lex_vec punct = LEX_OR(LEX_OR(LEX_EQ(v, LEX_SET(':')), LEX_EQ(v, LEX_SET('.'))),
+                             LEX_OR(LEX_EQ(v, LEX_SET(',')), LEX_EQ(v, LEX_SET('\0'))));
+      unsigned int stop = LEX_MASK(LEX_OR(lex_space(v), punct));
+      if (stop != 0) return i + __builtin_ctz(stop);
+   }
+#endif
+   for (; i < n && !is_delim(p[i]); i++);
+   return i;
+}
 
-// For the map.
-void Map_FreeStr (void *s);
-int Map_CmpStr (void *v1, void *v2);
-void Map_FreeClauses (void *arr_clauses);
 
 // Parsing helpers.
 // ======================================================================
 
 static inline int is_delim (char c)
 {
-   return isspace(c) || c == ':' || c == '.' || c == ',';
+   return isspace(c) || c == ':' || c == '.' || c == ',' || c == '\0';
+}
+
+   /**
+      The character offset places ahead of the parser, or '\0' past the
+      end of the text.
+   **/
+static inline char peek (DATA *data, long offset)
+{
+   long i = data->index + offset;
+   return i < data->len ? data->text[i] : '\0';
 }
 
 static inline int done(DATA * data)
@@ -139,126 +284,110 @@ static inline int done(DATA * data)
 
 static inline void skip_whitespace (DATA * data)
 {
-   while (data->index < data->len && isspace(data->text[data->index])) {
-      char c = data->text[data->index];
-      if (c == '\r' || c == '\n')
-         data->line_num++;
-      data->index++;      
-   }
+   long n = data->len - data->index;
+   long i = scan_space(data->text + data->index, n, &data->line_num);
+   data->index += i;
 }
 
-static inline Str *parse_line (DATA *data)
+static inline Token parse_string (DATA * data)
 {
    SKIP;
-   int i = 0;
-   while (!isspace(data->text[data->index+i])) i++;
-   char contents[i + 1];
-   memcpy(contents, data->text + data->index, i);
-   contents[i] = '\0';
+   long i = scan_token(data->text + data->index, data->len - data->index);
+   Token tok = { data->text + data->index, i };
    data->index += i;
-   return Str_Make(contents);
+   return tok;
 }
 
-static inline Str *parse_string (DATA * data)
+static inline Token peek_string (DATA * data)
 {
-   SKIP;
-   int i = 0;
-   while (!is_delim(data->text[data->index+i])) i++;
-   char contents[i + 1];
-   memcpy(contents, data->text + data->index, i);
-   contents[i] = '\0';
-   data->index += i;
-   return Str_Make(contents);
+   return parse_string(data);
 }
 
-static inline Str *peek_string (DATA * data)
+static inline int peek_keyword (DATA * data, char *keyword)
 {
-   SKIP;
-   int i = 0;
-   while (!is_delim(data->text[data->index+i])) i++;
-   char contents[i + 1];
-   memcpy(contents, data->text + data->index, i);
-   contents[i] = '\0';
-   data->index += i;
-   return Str_Make(contents);
+   long index = data->index;
+   int line_num = data->line_num;
+   Token tok = parse_string(data);
+   int found = tok_eq_ignore_case(tok, keyword);
+   data->index = index;
+   data->line_num = line_num;
+   return found;
 }
 
 static inline int parse_number (DATA * data)
 {
-   SKIP;
-   Str *s = parse_string(data);
-   if (!is_number(s))
+   Token tok = parse_string(data);
+   if (tok.len == 0)
       ERR("Num of inputs to program should be numeric value.");
-   int i = Str_ToInt(s);
-   free(s);
-   return i;
+   int i, n = 0;
+   for (i=0; i < tok.len; i++) {
+      if (!isdigit(tok.chars[i]))
+         ERR("Num of inputs to program should be numeric value.");
+      n = n * 10 + (tok.chars[i] - '0');
+   }
+   return n;
 }
 
 static inline int gobble_char (DATA * data, char c)
 {
    SKIP;
-   if (data->text[data->index] != c)
+   if (peek(data, 0) != c)
       return 0;
    data->index++;
    return 1;
 }
 
-static inline int gobble_str (DATA * data, char *s)
+static inline int gobble_token (DATA *data, char *s)
 {
    SKIP;
    int i;
-   for (i=0; s[i] != '\0' && isalnum(data->text[data->index+i]); i++) {
-      if (s[i] != data->text[data->index+i]) return 0;
+   for (i=0; s[i] != '\0' && !is_delim(peek(data, i)); i++) {
+      if (s[i] != peek(data, i)) return 0;
    }
-   if (isalnum(data->text[data->index+i])) return 0;
+   if (s[i] != '\0') return 0;
    data->index += i;
    return 1;
 }
 
-static inline int gobble_token (DATA *data, char *s)
+static inline int gobble_str_insensitive (DATA * data, char *s)
 {
    SKIP;
    int i;
-   for (i=0; s[i] != '\0' && !isspace(data->text[data->index+i]); i++) {
-      if (s[i] != data->text[data->index+i]) return 0;
+   for (i=0; s[i] != '\0' && isalnum(peek(data, i)); i++) {
+      if (tolower(s[i]) != tolower(peek(data, i))) return 0;
    }
+   if (isalnum(peek(data, i))) return 0;
    data->index += i;
    return 1;
 }
 
-static inline int gobble_str_insensitive (DATA * data, char *s)
+static inline int tok_eq (Token tok, char *s)
 {
-   SKIP;
-   int i;
-   for (i=0; s[i] != '\0' && isalnum(data->text[data->index+i]); i++) {
-      if (tolower(s[i]) != tolower(data->text[data->index+i])) return 0;
-   }
-   if (isalnum(data->text[data->index+i])) return 0;
-   data->index += i;
-   return 1;
+   return strncmp(tok.chars, s, tok.len) == 0 && s[tok.len] == '\0';
 }
 
-static inline int is_number (Str *string)
+static inline int tok_eq_ignore_case (Token tok, char *s)
 {
-   int i = 0;
-   char *chars = Str_Guts(string);
-   for (; i < Str_Len(string); i++) {
-      if (!isdigit(chars[i])) return 0;
-   }
-   return 1;
+   return strncasecmp(tok.chars, s, tok.len) == 0 && s[tok.len] == '\0';
+}
+
+   /**
+      The program's own copy of the token.
+   **/
+static inline Str *tok_intern (DATA *data, Token tok)
+{
+   return Prog_Intern(data->prog, tok.chars, tok.len);
 }
 
 // Parsing program header.
 // ======================================================================
 
    /**
-      HEADER ::= NAME INPUTS INITIAL [IMPORTS]?
+      HEADER ::= NAME INPUTS INITIAL [ENCODING]? [IMPORTS]?
    **/
 static inline void Parse_Header (DATA * data)
 {
 
-   // TODO: imports.
-
    // The things in the header to parse.
    // Note you can specify the header info in any order.
    int name, inputs, init;
@@ -269,20 +398,26 @@ static inline void Parse_Header (DATA * data)
    // Loop around checking for the stuff in the header.
    // Throw an error if something is defined more than once.
    // MaxIters is an upper bound; avoids parser running to end of file.
-   while (!(name && inputs && init) || i++ >= maxiters) {
+   int encoding = 0, imports = 0;
+   while (!(name && inputs && init) || peek_keyword(data, "encoding")
+          || peek_keyword(data, "imports") || i++ >= maxiters) {
 
       // Lookahead.
-      Str *s = peek_string(data);
+      long index = data->index;
+      int line_num = data->line_num;
+      Token s = peek_string(data);
+      data->index = index;
+      data->line_num = line_num;
 
       // Case: parsing name of program.
-      if (Str_EqIgnoreCase(s, "name")) {
+      if (tok_eq_ignore_case(s, "name")) {
          if (name) ERR("Name defined twice.");
          Parse_Name(data);
          name = 1;
       }
 
       // Case: parsing number of inputs to program.
-      else if (Str_EqIgnoreCase(s, "inputs")) {
+      else if (tok_eq_ignore_case(s, "inputs")) {
          if (inputs) ERR("Number of inputs defined twice.");
          Parse_Inputs(data);
          if (Prog_NumInputs(data->prog) < 0)
@@ -292,15 +427,29 @@ static inline void Parse_Header (DATA * data)
       }
 
       // Case: parsing name of initial state.
-      else if (Str_EqIgnoreCase(s, "init")) {
+      else if (tok_eq_ignore_case(s, "init")) {
          if (init) ERR("Initial state defined twice.");
          Parse_InitState(data);
          init = 1;      
       }
 
+      // Case: parsing the encoding of the inputs.
+      else if (tok_eq_ignore_case(s, "encoding")) {
+         if (encoding) ERR("Encoding defined twice.");
+         Parse_Encoding(data);
+         encoding = 1;
+      }
+
+      // Case: parsing the programs this one imports.
+      else if (tok_eq_ignore_case(s, "imports")) {
+         if (imports) ERR("Imports defined twice.");
+         Parse_Imports(data);
+         imports = 1;
+      }
+
       // case: Unknown, throw your hands in the air.
       else {
-         ERR("Unknown keyword in header file: '%s'", Str_Guts(s));
+         ERR("Unknown keyword in header file: '%.*s'", TOK(s));
       }
    }
 
@@ -319,9 +468,8 @@ static inline void Parse_Name (DATA * data)
    if (!gobble_str_insensitive(data, "Name"))
       ERR("Expected name declaration.");
    COLON;
-   Str *s = parse_string(data);
-   Prog_SetName(data->prog, s);
-   free(s);
+   Token s = parse_string(data);
+   Prog_SetName(data->prog, tok_intern(data, s));
    TERMINATOR;
 }
 
@@ -346,203 +494,203 @@ static inline void Parse_InitState (DATA * data)
    if (!gobble_str_insensitive(data, "Init"))
       ERR("Expected declaration of initial state.");
    COLON;
-   Str *init_state = parse_string(data);
-   Prog_SetInitState(data->prog, init_state);
-   free(init_state);
+   Token init_state = parse_string(data);
+   Prog_SetInitState(data->prog, tok_intern(data, init_state));
    TERMINATOR;
 }
 
 
+   /**
+      ENCODING ::= Encoding: [unary | binary | decimal | symbols].
+   **/
+static inline void Parse_Encoding (DATA * data)
+{
+   if (!gobble_str_insensitive(data, "Encoding"))
+      ERR("Expected encoding declaration.");
+   COLON;
+   Token s = parse_string(data);
+   Encoding encoding;
+   if (tok_eq_ignore_case(s, "unary"))        encoding = ENC_UNARY;
+   else if (tok_eq_ignore_case(s, "binary"))  encoding = ENC_BINARY;
+   else if (tok_eq_ignore_case(s, "decimal")) encoding = ENC_DECIMAL;
+   else if (tok_eq_ignore_case(s, "symbols")) encoding = ENC_SYMBOLS;
+   else ERR("Unknown encoding '%.*s'.", TOK(s));
+   Prog_SetEncoding(data->prog, encoding);
+   TERMINATOR;
+}
+
+
+   /**
+      IMPORTS ::= Imports: [IDEN]+ [,IDEN]*.
+   **/
+static inline void Parse_Imports (DATA * data)
+{
+   if (!gobble_str_insensitive(data, "Imports"))
+      ERR("Expected imports declaration.");
+   COLON;
+   do {
+      Token tok = parse_string(data);
+      Str *name = tok_intern(data, tok);
+      Program *module = NULL;
+      if (!(data->flags & PARSE_DEFER)) {
+         module = Import_Load(name, data->dir, data->err, data->err_len);
+         if (module == NULL) longjmp(data->bail, 1);
+      }
+      if (!Prog_AddImport(data->prog, name, module, data->err, data->err_len))
+         longjmp(data->bail, 1);
+   } while (gobble_char(data, ','));
+   TERMINATOR;
+}
+
 
 // Parsing state declarations.
 // ======================================================================
 
+   /**
+      DEFINITION ::= IDEN: [CLAUSE]+
+      States are parsed in one pass: each one's clauses are gathered into
+      the parser's clause buffers and handed to the program once the next
+      state (or the end of the file) is reached.
+   **/
 static inline void Parse_States (DATA * data)
 {
-
-   // Figure out how many states in this program.
-   int num_states = count_states(data);
+   int num_states = 0;
+   while (!DONE) {
+      Parse_State(data);
+      num_states++;
+   }
    if (num_states == 0)
       ERR("No states found!");
-
-   // Parse the states.
-   while (!DONE) Parse_State (data);
-   
 }
 
 static inline void Parse_State (DATA *data)
 {
 
-   // Parse name of state.
-   Str *state_name = parse_string(data);
+   // Parse name of state. This is where it gets interned.
+   Str *state_name = tok_intern(data, parse_string(data));
 
    if (Prog_IsStateDefined(data->prog, state_name))
-      ERR("Duplicate state found.");
-   COLON;
-
-   // Count number of clauses.
-   int num_clauses = count_clauses(data);
-   if (num_clauses < 1)
-      ERR("Need at least one clause.");
-
-   char *clauses_inputs = calloc(num_clauses + 1, sizeof(char));
-   Instruction *clauses_instrs = calloc(num_clauses + 1, sizeof(Instruction));
-   Str **clauses_strs = calloc(num_clauses + 1, sizeof(Str *));
+      ERR("Duplicate state found on line %d.", data->line_num);
+   if (!gobble_char(data, ':'))
+      ERR("Expected state, got something unknown on line %d.", data->line_num);
 
-   // Parse the clauses.
-   int i;
-   for (i=0; i < num_clauses; i++) {
-      Parse_Clause (data, i, clauses_inputs, clauses_instrs, clauses_strs);
+   // Parse clauses until something that isn't one turns up.
+   int num_clauses = 0;
+   while (!DONE) {
+      long index = data->index;
+      int line_num = data->line_num;
+      Token input = parse_string(data);
+      if (!gobble_token(data, "->")) {
+         data->index = index;
+         data->line_num = line_num;
+         break;
+      }
+      if (num_clauses == data->capacity)
+         grow_clauses(data);
+      Parse_Clause (data, input, num_clauses);
+      num_clauses++;
    }
+   if (num_clauses < 1)
+      ERR("No clauses given for state '%s'.", Str_Chars(state_name));
 
    // Put the state -> clauses pair into the program.
    Prog_AddState (data->prog, state_name, num_clauses,
-                  clauses_inputs, clauses_instrs, clauses_strs);
-   
-   // This is the price of freedom.
-   free(state_name);
-   free(clauses_inputs);
-   free(clauses_instrs);
-   for (i=0; i < num_clauses; i++) {
-      Str_Free(clauses_strs[i]);
-   }
-   free(clauses_strs);
+                  data->inputs, data->instrs, data->end_states);
 
 }
 
-static inline void Parse_Clause (DATA *data, int index, char *inputs,
-                                 Instruction *instructions, Str **end_states)
+   /**
+      CLAUSE ::= [NUMBER | LETTER | blank] -> ACTION, IDEN.
+      The input and arrow have already been parsed; the clause goes in the
+      clause buffers at the given index.
+   **/
+static inline void Parse_Clause (DATA *data, Token input_s, int index)
 {
    
-   // Parse the clause.
-   Str *input_s = parse_string(data);
-   ARROW;
-   Str *action = parse_string(data);
+   // Parse the rest of the clause.
+   Token action = parse_string(data);
    COMMA;
-   Str *transition = parse_string(data);
+   Token transition = parse_string(data);
    TERMINATOR;
 
    // Convert input to appropriate char.
    char input;
-   if (Str_Eq(input_s, "blank"))
+   if (tok_eq(input_s, "blank"))
       input = BLANK;
-   else if (Str_Len(input_s) != 1)
+   else if (input_s.len != 1)
       ERR("Input for clause must be a single character or blank.");
-   input = Str_CharAt(input_s, 0);
+   else
+      input = input_s.chars[0];
 
    // Convert action to an instruction.
    Action act; char output;
-   if (Str_Eq(action, "right"))        { act = M_RIGHT; output = '\0'; }
-   else if (Str_Eq(action, "left"))    { act = M_LEFT;  output = '\0'; }
-   else if (Str_Eq(input_s, "blank"))  { act = M_PRINT; output = ' '; }
-   else if (Str_Len(input_s) == 1)     { act = M_PRINT; output = Str_CharAt(input_s, 0); }
+   if (tok_eq(action, "right"))        { act = M_RIGHT; output = '\0'; }
+   else if (tok_eq(action, "left"))    { act = M_LEFT;  output = '\0'; }
+   else if (tok_eq(action, "blank"))   { act = M_PRINT; output = BLANK; }
+   else if (action.len == 1)           { act = M_PRINT; output = action.chars[0]; }
    else ERR ("Unknown action for clause.");
    Instruction instr = { act, output };
 
    // Put data at current index.
-   inputs[index] = input;
-   instructions[index] = instr;
-   end_states[index] = Str_Make(Str_Guts(transition));
-
-   // Free all the stuff we've used.
-   free(input_s);
-   free(action);
-   free(transition);
+   data->inputs[index] = input;
+   data->instrs[index] = instr;
+   data->end_states[index] = tok_intern(data, transition);
 
 }
 
-static inline int count_clauses (DATA *data)
+   /**
+      Double the size of the clause buffers. They are reused for every
+      state, so they only grow to fit the biggest one.
+   **/
+static void grow_clauses (DATA *data)
 {
-   int ogIndex = data->index;
-   int num_clauses = 0;
-
-   Str *s = NULL;
-
-   while (!done(data)) {
-      s = parse_string(data);
-      if (!gobble_token(data, "->"))
-         break;
-      s = parse_string(data);
-      COMMA;
-      s = parse_string(data);
-      TERMINATOR;
-      num_clauses++;
-   }
-
-   if (s != NULL) Str_Free(s);
-   data->index = ogIndex;
-   return num_clauses;
-
+   int capacity = data->capacity > 0 ? data->capacity * 2 : 8;
+   data->inputs = realloc(data->inputs, capacity * sizeof(char));
+   data->instrs = realloc(data->instrs, capacity * sizeof(Instruction));
+   data->end_states = realloc(data->end_states, capacity * sizeof(Str *));
+   data->capacity = capacity;
 }
 
-static inline int count_states (DATA * data)
+   /**
+      Give up on the program, with the given message.
+   **/
+static _Noreturn void fail (DATA *data, char *fmt, ...)
 {
-
-   int ogIndex = data->index;
-   int num_states = 0;
-
-   Str *s;
-
-   while (!done(data)) {
-
-      // Parse state identifier and colon.
-      s = parse_string(data); // identifier
-      if (!gobble_char(data, ':'))
-         ERR("Expected state, got something unknown.");
-      num_states++;
-
-      // Looking through a state. Skip over the clauses.
-      int num_clauses = 0;
-      while (1) {
-
-         // Check if you're at the end.
-         if (done(data)) break;
-
-         // Check if you're parsing another clause, or are inside
-         // an entirely new state definition.
-         int indexb4 = data->index;
-         s = parse_string(data);
-         if (!gobble_token(data, "->")) {
-            data->index = indexb4;
-            break;
-         }
-           
-         // Parse the rest of the clause.
-         s = parse_string(data);
-         COMMA;
-         s = parse_string(data);
-         TERMINATOR;
-         num_clauses++;
-
-      }
-
-      // Done parsing state. Check number of clauses.
-      if (num_clauses == 0)
-         ERR("No clauses given for state definition."); 
-
-   }
-
-   // Clean up, reset parser, return count.
-   if (s != NULL) Str_Free(s);
-   data->index = ogIndex;
-   return num_states;
-
+   va_list args;
+   va_start(args, fmt);
+   if (data->err != NULL) vsnprintf(data->err, data->err_len, fmt, args);
+   va_end(args);
+   longjmp(data->bail, 1);
 }
 
-
-// Public functions.
-// ======================================================================
-
-Program *Parser_ProgFromString (Str *string)
+   /**
+      Parse the program in text[0..len), which came from the file name.
+      Returns NULL if it isn't valid.
+   **/
+static Program *parse_text (char *text, long len, char *name, char *dir,
+                            int flags, char *err, int err_len)
 {
 
    // Ready the parser.
    struct parse_data *data = malloc(sizeof(struct parse_data));
    data->index = 0;
-   data->len = Str_Len(string);
-   data->text = Str_Guts(string);
+   data->len = len;
+   data->text = text;
+   data->dir = dir;
+   data->flags = flags;
    data->line_num = 1;
    data->prog = Prog_Make();
+   data->inputs = NULL;
+   data->instrs = NULL;
+   data->end_states = NULL;
+   data->capacity = 0;
+   data->err = err;
+   data->err_len = err_len;
+   Program *prog = NULL;
+   if (setjmp(data->bail)) {
+      Prog_Free(data->prog);
+      goto done;
+   }
 
    // Parse meta info.
    Parse_Header(data);
@@ -550,53 +698,112 @@ Program *Parser_ProgFromString (Str *string)
    // Parse states.
    Parse_States(data);
 
-   // Check the program is a good one.
-   // validate_program(data->prog);
-   
+   // Check the program is a good one, and index its states. That has to
+   // wait for imports which haven't been loaded yet.
+   if (Prog_NumImports(data->prog) == 0 || !(flags & PARSE_DEFER)) {
+      char msg[PARSE_ERR_MAX];
+      if (!Prog_Finalise(data->prog, msg, sizeof(msg)))
+         ERR("%s: %s", name, msg);
+   }
+   prog = data->prog;
+
    // Free stuff.
-   Program *prog = data->prog;
+   done:
+   free(data->inputs);
+   free(data->instrs);
+   free(data->end_states);
    free(data);
    return prog;
 
 }
 
-Program *Parser_ProgFromFile (Str *fname_str)
+
+// Public functions.
+// ======================================================================
+
+Program *Parser_ProgFromString (Str *string)
 {
+   char *text = Str_Chars(string);
+   char err[PARSE_ERR_MAX];
+   err[0] = '\0';
+   Program *prog;
+   if (Quint_IsQuintuple(text, Str_Len(string)))
+      prog = Quint_ProgFromText(text, Str_Len(string), "program", err, sizeof(err));
+   else
+      prog = parse_text(text, Str_Len(string), "program", "", 0, err, sizeof(err));
+   if (prog == NULL)
+      fprintf(stderr, "%s\n", err);
+   else if (err[0] != '\0')
+      fprintf(stderr, "Warning: %s\n", err);
+   return prog;
+}
 
-   // Get filename, check it exists.
-   char *fname = Str_Guts(fname_str);
-   if (access(fname, F_OK) == -1)
-      goto FNFerr;
-
-   // Open file, figure out length of buffer.
-   char *buffer = NULL;
-   long length;
-   FILE *f = fopen (fname, "rb");
-   if (!f) goto IOerr;
-   fseek(f, 0, SEEK_END);
-   length = ftell(f);
-   fseek(f, 0, SEEK_SET);
-   buffer = malloc (length + 1);
-   if (!buffer) goto IOerr;
-
-   // Copy file contents into a string and parse the program.
-   fread (buffer, sizeof(char), length, f);
-   buffer[length] = '\0';
-   Str *source_code = Str_Make(buffer);
-   Program *prog = Parser_ProgFromString(source_code);
-
-   // Cleanup and return.
-   free(buffer);
-   Str_Free(source_code);
-   fclose(f);
+Program *Parser_ProgFromFile (Str *fname_str)
+{
+   char err[PARSE_ERR_MAX];
+   err[0] = '\0';
+   Program *prog = Parser_Load(Str_Chars(fname_str), 0, err, sizeof(err));
+   if (err[0] != '\0')
+      fprintf(stderr, prog == NULL ? "%s\n" : "Warning: %s\n", err);
    return prog;
+}
 
-   FNFerr:
+Program *Parser_Load (char *fname, int flags, char *err, int err_len)
+{
+
+   // Open the file and map it; the parser reads straight from the mapping.
+   if (err != NULL && err_len > 0) err[0] = '\0';
+   int fd = open(fname, O_RDONLY);
+   struct stat st;
+   if (fd == -1)
       return NULL;
+   if (fstat(fd, &st) == -1)
+      goto err;
 
-   IOerr:
-      fclose(f);
+   // mmap won't map an empty file, but there's nothing to map anyway.
+   Program *prog;
+   if (st.st_size == 0) {
+      prog = parse_text("", 0, fname, "", flags, err, err_len);
+   }
+   else {
+      char *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (text == MAP_FAILED)
+         goto err;
+
+      // Compiled programs are used straight from the mapping.
+      if (Prog_IsImage(text, st.st_size)) {
+         prog = Prog_FromImage(text, st.st_size);
+         if (prog == NULL) {
+            if (err != NULL)
+               snprintf(err, err_len, "Compiled program %s is corrupt or from another version.", fname);
+            munmap(text, st.st_size);
+         }
+         close(fd);
+         return prog;
+      }
+      madvise(text, st.st_size, MADV_SEQUENTIAL);
+
+      // Quintuple programs have no header, so they are named after the
+      // file. Imports are found next to the file.
+      char *slash = strrchr(fname, '/');
+      if (Quint_IsQuintuple(text, st.st_size)) {
+         prog = Quint_ProgFromText(text, st.st_size, slash == NULL ? fname : slash + 1,
+                                   err, err_len);
+      }
+      else {
+         int dir_len = slash == NULL ? 0 : slash - fname;
+         char dir[dir_len + 1];
+         memcpy(dir, fname, dir_len);
+         dir[dir_len] = '\0';
+         prog = parse_text(text, st.st_size, fname, dir, flags, err, err_len);
+      }
+      munmap(text, st.st_size);
+   }
+   close(fd);
+   return prog;
+
+   err:
+      close(fd);
       return NULL;
 
 }
-
@@ -17,14 +17,46 @@
    #include "program.h"
 
    /**
-      Return the program described by the specified input string.
+      The longest error message the parser writes, including its null.
+   **/
+   #define PARSE_ERR_MAX 256
+
+   /**
+      Flags for Parser_Load.
+         PARSE_DEFER : don't load the program's imports. A program that
+            has some is returned unfinalised, for the caller to give them
+            with Prog_SetImport and then finalise it.
+   **/
+   #define PARSE_DEFER 1
+
+   /**
+      Return the program described by the specified input string. If it
+      isn't a valid program, the reason is printed and NULL is returned;
+      any warnings are printed too.
    **/
    Program *Parser_ProgFromString (Str *string);
 
    /**
       Return the program described by the contents of the file.
-      Returns a null pointer if the file does not exist.
+      Returns a null pointer if the file does not exist. Programs in
+      the quintuple format (see quintuple.h) are recognised and parsed
+      with that frontend instead; so are strings given to
+      Parser_ProgFromString. Compiled programs (see Prog_Save) are
+      loaded without parsing. If the file isn't a valid program, the
+      reason is printed and NULL is returned; any warnings are printed
+      too.
    **/
    Program *Parser_ProgFromFile (Str *fname);
 
+   /**
+      Like Parser_ProgFromFile, but the reason a file isn't a valid
+      program is written to err[0..err_len) instead of being printed
+      (err is left empty if the file can't be opened). If the program
+      loads, err holds a warning about it, or is empty if there is none. flags is 0 or
+      PARSE_DEFER. The parser keeps no state of its own, so different
+      files can be parsed on different threads at once, as long as none
+      of them load imports.
+   **/
+   Program *Parser_Load (char *fname, int flags, char *err, int err_len);
+
 #endif
@@ -1,5 +1,12 @@
 
+#include <stdarg.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include "program.h"
+#include "typed_map.h"
+#include "mph.h"
 
 
 #define ERR_MSG(...) do {\
@@ -12,6 +19,99 @@
 // Data structures.
 // ======================================================================
 
+struct clause;
+
+   /**
+      Whether s names the state whose interned name is name. An interned
+      s has to be that very name: a state of an imported program can have
+      the same name as one of ours, but it is interned in the other
+      program's table and is a different state.
+   **/
+static inline int same_state (Str *name, Str *s)
+{
+   return Str_IsInterned(s) ? name == s : Str_Same(name, s);
+}
+
+   /**
+      Map from state names to their (null-terminated) arrays of clauses.
+      The keys are the program's interned names.
+   **/
+MAP_DEFINE(StateMap, Str *, struct clause **, Str_Hash, same_state)
+
+   /**
+      A compiled image (a .tmc file) is a finalised program flattened into
+      one block, with every state (including those of its imports) given an
+      id. It is laid out as a header, then the state table, the transition
+      table and the state names, all addressed by offsets from the start so
+      it can be mapped anywhere. The header:
+         magic, version : "TMC" and the format version.
+         byte_order : TMC_BYTE_ORDER as written by the compiling machine;
+            images are only loaded on machines with the same byte order.
+         size : the size of the whole image.
+         num_states : number of states, so ids are [0, num_states).
+         num_own : how many of them are the program's own (the first ids).
+         num_symbols : number of symbols the program reads.
+         init : id of the initial state.
+         num_inputs, encoding : as for any program.
+         name : offset of the program's name.
+         states : offset of the state table.
+         trans : offset of the transition table, a row of num_symbols
+            transitions for each state.
+         alphabet : the column of each symbol in the rows, or TMC_NONE if
+            the program never reads it.
+   **/
+#define TMC_MAGIC "TMC"
+#define TMC_VERSION 2
+#define TMC_BYTE_ORDER 0x01020304u
+#define TMC_NONE 0xFF
+
+struct tmc_header {
+   char magic[4];
+   uint32_t version;
+   uint32_t byte_order;
+   uint32_t size;
+   uint32_t num_states;
+   uint32_t num_own;
+   uint32_t num_symbols;
+   uint32_t init;
+   int32_t num_inputs;
+   uint32_t encoding;
+   uint32_t name;
+   uint32_t states;
+   uint32_t trans;
+   unsigned char alphabet[256];
+};
+
+   /**
+      A state in an image: the offset and length of its name (which is
+      null-terminated), the name's hash, and whether it has any clauses.
+   **/
+struct tmc_state {
+   uint32_t name;
+   uint32_t len;
+   uint32_t hash;
+   uint32_t defined;
+};
+
+   /**
+      A transition in an image. action is M_ERR if there's no clause for
+      the symbol; next is the id of the next state.
+   **/
+struct tmc_trans {
+   uint8_t action;
+   char output;
+   uint16_t pad;
+   int32_t next;
+};
+
+   /**
+      A program imported under the given name.
+   **/
+struct import {
+   Str *name;
+   struct program *module;
+};
+
    /**
       This is the representation of a program that can be executed by an
       interpreter. The members are:
@@ -19,16 +119,49 @@
          name : the name of the program.
          init_state : state the program should start in.
          num_inputs : number of inputs to the program. 
+         encoding : how inputs to the program are written on the tape.
          finalised : whether the program has been correctly set up.   
             If a program has been set up it is an error to try and modify
             its members.
+         arena : owns everything the program allocates (clauses, clause
+            arrays and interned names), so it is all freed in one go.
+         names : the program's state names and name, interned.
+         index : once finalised, a minimal perfect hash of the state
+            names, so a state is found with one probe. NULL before then,
+            or if it couldn't be built, in which case states is used.
+         ids : the state name for each index, to check a lookup hit.
+         rows : the clauses for each index.
+         imports : the programs this one imports, num_imports of them. They
+            are shared, so they belong to whoever loaded them.
+         image : for a program loaded from a compiled image, the mapped
+            image, which is used in place; image_len bytes of it. NULL for
+            any other program. The program's states are then image_states,
+            one for each id, and states is empty.
+         canon : the states reachable from the initial state, in the
+            canonical order Prog_Fingerprint numbers them in; num_canon
+            of them. NULL until the fingerprint is worked out.
+         fingerprint : the program's fingerprint, once canon is set.
    **/
 struct program {
-   Map *states; // Str -> Array of Clauses
+   StateMap *states; // Str -> Array of Clauses
+   Arena *arena;
+   StrTable *names;
    Str *name;
    Str *init_state;
    int num_inputs;
+   Encoding encoding;
    int finalised;
+   Mph *index;
+   Str **ids;
+   struct clause ***rows;
+   struct import *imports;
+   int num_imports;
+   struct tmc_header *image;
+   long image_len;
+   Str *image_states;
+   Str **canon;
+   int num_canon;
+   unsigned long fingerprint;
 };
 
    /**
@@ -56,13 +189,14 @@ void Prog_Free (struct program *prog);
 // Private function declarations.
 // ======================================================================
 
-struct clause *Clause_Make (char input, Instruction instr, Str *end_state);
-void Clause_Free (struct clause *clause);
+struct clause *Clause_Make (Program *prog, char input, Instruction instr, Str *end_state);
 int Clause_SizeOf();  
-void Map_FreeStr (void *s);
-int Map_CmpStr (void *v1, void *v2);
-void Map_FreeClauses (void *arr_clauses);
-unsigned int Map_HashStr (void *v1);
+static int prog_error (char *err, int err_len, char *fmt, ...);
+static void link_imports (Program *prog);
+static inline int image_id (Program *prog, Str *state);
+static inline struct tmc_trans *image_trans (Program *prog, Str *state, char input);
+static void build_index (Program *prog);
+static struct clause **state_clauses (Program *prog, Str *state);
 
 
 
@@ -77,9 +211,8 @@ void Prog_SetName (struct program *prog, Str *str)
       ERR_MSG("Error setting program name:\
                program metadata cannot be modified after it has been finalised.");
 
-   // Copy name and set string.
-   prog->name = malloc(Str_SizeOf());
-   memcpy(prog->name, str, Str_SizeOf());
+   // Keep a copy of the name.
+   prog->name = Str_Intern(prog->names, str);
 
 }
 
@@ -91,9 +224,8 @@ void Prog_SetInitState (struct program *prog, Str *state_name)
       ERR_MSG("Error setting initial state:\
                program metadata cannot be modified after it has been finalised.");
 
-   // Copy name and set string.
-   prog->init_state = malloc(Str_SizeOf());
-   memcpy(prog->init_state, state_name, Str_SizeOf());
+   // State names are interned.
+   prog->init_state = Str_Intern(prog->names, state_name);
 
 }
 
@@ -110,6 +242,24 @@ void Prog_SetNumInputs (struct program *prog, int inputs)
 
 }
 
+void Prog_SetEncoding (struct program *prog, Encoding encoding)
+{
+
+   // Error check.
+   if (prog->finalised)
+      ERR_MSG("Error setting encoding of program:\
+               program metadata cannot be modified after it has been finalised.");
+
+   // Set encoding.
+   prog->encoding = encoding;
+
+}
+
+Str *Prog_Intern (Program *prog, char *chars, int len)
+{
+   return Str_InternChars(prog->names, chars, len);
+}
+
 void Prog_AddState (Program *prog, Str *state_name, int num_clauses,
                     char *inputs, struct instruction *instrs, Str **end_states)
 {
@@ -122,48 +272,101 @@ void Prog_AddState (Program *prog, Str *state_name, int num_clauses,
       ERR_MSG("Need at least 1 clause per state.");
 
    // Note the use of calloc: this is a null-terminated array.
-   struct clause **arr_clauses = calloc(num_clauses + 1, Clause_SizeOf());
+   struct clause **arr_clauses = Arena_Calloc(prog->arena, num_clauses + 1,
+                                              sizeof(struct clause *));
 
    // Allocate and build clauses.
    int i;
    for (i=0 ; i < num_clauses; i++) {
-      arr_clauses[i] = Clause_Make(inputs[i], instrs[i], end_states[i]);
+      arr_clauses[i] = Clause_Make(prog, inputs[i], instrs[i], end_states[i]);
    }
 
-   // Put into map.
-   Str *s = malloc(Str_SizeOf());
-   memcpy(s, state_name, Str_SizeOf());
-   Map_Put(prog->states, s, arr_clauses);
+   // Put into map, keyed by the interned name.
+   Str *s = Str_Intern(prog->names, state_name);
+   StateMap_Put(prog->states, s, arr_clauses);
 
 }
 
-void Prog_Finalise (Program *prog)
+int Prog_AddImport (Program *prog, Str *name, Program *module, char *err, int err_len)
+{
+
+   // Error checking.
+   if (prog->finalised)
+      return prog_error(err, err_len, "Error adding import to program:\
+               program cannot be modified after it has been finalised.");
+
+   prog->imports = realloc(prog->imports, (prog->num_imports + 1) * sizeof(struct import));
+   prog->imports[prog->num_imports].name = Str_Intern(prog->names, name);
+   prog->imports[prog->num_imports].module = NULL;
+   prog->num_imports++;
+   if (module != NULL)
+      return Prog_SetImport(prog, prog->num_imports - 1, module, err, err_len);
+   return 1;
+
+}
+
+int Prog_SetImport (Program *prog, int i, Program *module, char *err, int err_len)
+{
+
+   // Error checking.
+   if (prog->finalised)
+      return prog_error(err, err_len, "Error setting import of program:\
+               program cannot be modified after it has been finalised.");
+   if (!module->finalised)
+      return prog_error(err, err_len, "Error adding import to program: "
+                        "imported program isn't finalised.");
+   if (module->image != NULL)
+      return prog_error(err, err_len, "Error adding import '%s' to program: "
+                        "compiled programs can't be imported.",
+                        Str_Chars(prog->imports[i].name));
+
+   prog->imports[i].module = module;
+   return 1;
+
+}
+
+int Prog_Finalise (Program *prog, char *err, int err_len)
 {
 
    // Check user is calling at the right time.
    if (prog->finalised)
-      ERR_MSG("Error finalising: Program is already finalised.");
+      return prog_error(err, err_len, "Error finalising: Program is already finalised.");
    
    // Check everything has been defined.
-   if (prog->states == NULL || Prog_NumInputs(prog) <= 0)
-      ERR_MSG("Error finalising: program has no states.");
+   if (prog->states == NULL || (Prog_NumInputs(prog) <= 0 && prog->num_inputs != PROG_ANY_INPUTS))
+      return prog_error(err, err_len, "Error finalising: program has no states.");
 
    if (prog->name == NULL)
-      ERR_MSG("Error finalising: program has no name.");
+      return prog_error(err, err_len, "Error finalising: program has no name.");
 
    if (prog->init_state == NULL)
-      ERR_MSG("Error finalising: program has no initial state.");
+      return prog_error(err, err_len, "Error finalising: program has no initial state.");
 
-   // Check those definitions are sensible.
+   // Check those definitions are sensible. The initial state may be an
+   // imported program.
+   int i;
+   for (i=0; i < prog->num_imports; i++) {
+      if (prog->imports[i].module == NULL)
+         return prog_error(err, err_len, "Error finalising: import '%s' was never given.",
+                           Str_Chars(prog->imports[i].name));
+   }
+   link_imports(prog);
    if (!Prog_IsStateDefined(prog, prog->init_state))
-      ERR_MSG("Error finalising: could not find the specified initial state.");
+      return prog_error(err, err_len, "Error finalising: could not find the specified initial state.");
 
-   if (prog->num_inputs < 0)
-      ERR_MSG("Error finalising: program must have non-negative number of inputs.");
+   if (prog->num_inputs < 0 && prog->num_inputs != PROG_ANY_INPUTS)
+      return prog_error(err, err_len, "Error finalising: program must have non-negative number of inputs.");
+   if (prog->num_inputs > PROG_MAX_INPUTS)
+      return prog_error(err, err_len, "Error finalising: program can't take more than %d inputs.",
+                        PROG_MAX_INPUTS);
    
    // Everything looks fine; mark program as finalised.
    prog->finalised = 1;
 
+   // The states are fixed from now on, so they can be indexed.
+   build_index(prog);
+   return 1;
+
 }
 
 
@@ -173,7 +376,47 @@ void Prog_Finalise (Program *prog)
 
 int Prog_IsStateDefined (struct program *prog, Str *s)
 {
-   return Map_Contains (prog->states, s);
+   if (prog->image != NULL) return Prog_StateId(prog, s) >= 0;
+   return state_clauses(prog, s) != NULL;
+}
+
+int Prog_StateId (struct program *prog, Str *s)
+{
+   if (prog->image != NULL) {
+      int id = image_id(prog, s);
+      struct tmc_state *st = (struct tmc_state *)((char *)prog->image + prog->image->states);
+      return id >= 0 && st[id].defined ? id : -1;
+   }
+   if (prog->index == NULL) return -1;
+   int id = Mph_Index(prog->index, Str_Hash(s));
+   return same_state(prog->ids[id], s) ? id : -1;
+}
+
+Str *Prog_FindState (struct program *prog, Str *s)
+{
+   if (prog->image != NULL) {
+      int id = Prog_StateId(prog, s);
+      if (id >= 0) return &prog->image_states[id];
+   }
+   else if (state_clauses(prog, s) != NULL) {
+      return s;
+   }
+   return Str_InternChars(prog->names, Str_Chars(s), Str_Len(s));
+}
+
+int Prog_NumImports (Program *prog)
+{
+   return prog->num_imports;
+}
+
+Str *Prog_ImportName (Program *prog, int i)
+{
+   return prog->imports[i].name;
+}
+
+int Prog_IsFinalised (Program *prog)
+{
+   return prog->finalised;
 }
 
 Str *Prog_Name (struct program *prog)
@@ -188,31 +431,42 @@ int Prog_NumInputs (struct program *prog)
    return prog->num_inputs;
 }
 
+Encoding Prog_Encoding (struct program *prog)
+{
+   return prog->encoding;
+}
+
 Str *Prog_InitState (struct program *prog)
 {
-   Str *s = malloc(Str_SizeOf());
-   memcpy(s, prog->init_state, Str_SizeOf());
-   return s;
+   return prog->init_state;
 }
 
 int Prog_NumStates (struct program *prog)
 {
-   return Map_Size(prog->states);
+   if (prog->image != NULL) return prog->image->num_own;
+   return StateMap_Size(prog->states);
 }
 
 Instruction Prog_NextInstruction (Program *prog, Str *state, char input)
 {
 
+   // Compiled programs look the transition up directly.
+   if (prog->image != NULL) {
+      struct tmc_trans *t = image_trans(prog, state, input);
+      Instruction instr = { t == NULL ? M_ERR : t->action, t == NULL ? '\0' : t->output };
+      return instr;
+   }
+
    // Check the state exists.
-   if (!Map_Contains(prog->states, state)) {
+   struct clause **clauses = state_clauses(prog, state);
+   if (clauses == NULL) {
       Instruction instr = { M_ERR, '\0' };
       return instr;
    }
   
    // Look through clauses and return the appropriate instruction.
-   struct clause **clauses = Map_Get(prog->states, state);
    int i;
-   for (i=0; clauses[i] != '\0'; i++) {
+   for (i=0; clauses[i] != NULL; i++) {
       if (clauses[i]->input == input) {
          return clauses[i]->instruction;      
       }   
@@ -226,19 +480,24 @@ Instruction Prog_NextInstruction (Program *prog, Str *state, char input)
 
 Str *Prog_NextTransition (Program *prog, Str *state, char input)
 {
+
+   // Compiled programs look the transition up directly.
+   if (prog->image != NULL) {
+      struct tmc_trans *t = image_trans(prog, state, input);
+      return t == NULL ? NULL : &prog->image_states[t->next];
+   }
    
    // Check the state exists.
-   if (!Map_Contains(prog->states, state)) {
+   struct clause **clauses = state_clauses(prog, state);
+   if (clauses == NULL) {
       return NULL;
    }
 
    // Look through clauses and return the appropriate instruction.
-   struct clause **clauses = Map_Get(prog->states, state);
    int i;
-   for (i=0; clauses[i] != '\0'; i++) {
+   for (i=0; clauses[i] != NULL; i++) {
       if (clauses[i]->input == input) {
-         Str *s = Str_Copy(clauses[i]->end_state);
-         return s;
+         return clauses[i]->end_state;
       }   
    }
 
@@ -254,24 +513,39 @@ Str *Prog_NextTransition (Program *prog, Str *state, char input)
 Program *Prog_Make (void)
 {
    struct program *prog = malloc(Prog_SizeOf());
-   prog->states = Map_Make (2,
-                            Str_SizeOf(), sizeof(struct clause **),
-                            Map_HashStr, // hash function
-                            Map_FreeStr, Map_CmpStr,
-                            NULL, NULL);
+   prog->arena = Arena_Make();
+   prog->names = StrTable_Make(prog->arena);
+   prog->states = StateMap_Make(2);
    prog->name = NULL;
    prog->init_state = NULL;
    prog->num_inputs = -1;
+   prog->encoding = ENC_UNARY;
    prog->finalised = 0;
+   prog->index = NULL;
+   prog->ids = NULL;
+   prog->rows = NULL;
+   prog->imports = NULL;
+   prog->num_imports = 0;
+   prog->image = NULL;
+   prog->image_len = 0;
+   prog->image_states = NULL;
+   prog->canon = NULL;
+   prog->num_canon = 0;
+   prog->fingerprint = 0;
    return prog;
 }
 
 void Prog_Free (struct program *prog)
 {
-   Map_Free(prog->states);
-   //Str_Free(prog->name);
-   //Str_Free(prog->init_state);
-   //free(prog);
+   StateMap_Free(prog->states);
+   if (prog->index != NULL) Mph_Free(prog->index);
+   free(prog->imports);
+   if (prog->image != NULL) munmap(prog->image, prog->image_len);
+   free(prog->image_states);
+   free(prog->canon);
+   StrTable_Free(prog->names);
+   Arena_Free(prog->arena);
+   free(prog);
 }
 
 int Prog_SizeOf()
@@ -284,79 +558,563 @@ int Prog_SizeOf()
 // Private functions.
 // ======================================================================
 
-struct clause *Clause_Make (char input, Instruction instr, Str *end_state)
+struct clause *Clause_Make (Program *prog, char input, Instruction instr, Str *end_state)
 {
-   struct clause *cl = malloc(Clause_SizeOf());
+   struct clause *cl = Arena_Alloc(prog->arena, Clause_SizeOf());
    cl->input = input;
    cl->instruction = instr;
-   cl->end_state = malloc(Str_SizeOf());
-   memcpy(cl->end_state, end_state, Str_SizeOf());
+   cl->end_state = Str_Intern(prog->names, end_state);
    return cl;
 }
 
-void Clause_Free (struct clause *clause)
+int Clause_SizeOf()
 {
-   Str_Free(clause->end_state);
-   free(clause);
+   return sizeof(struct clause);
 }
 
-int Clause_SizeOf()
+   /**
+      Build the perfect hash of the state names. The names are interned, so
+      their hashes are already to hand and lookups can compare serials. If
+      two names happen to share a hash there is no perfect hash; the program
+      just keeps using its map.
+   **/
+static void build_index (Program *prog)
 {
-   return sizeof(struct clause);
+   int n = StateMap_Size(prog->states);
+   if (n == 0) return;
+   unsigned int *hashes = malloc(n * sizeof(unsigned int));
+   Str **names = malloc(n * sizeof(Str *));
+   struct clause ***rows = malloc(n * sizeof(struct clause **));
+
+   // Gather the states.
+   int cursor = 0, i = 0;
+   Str *name;
+   struct clause ***clauses;
+   while (StateMap_Next(prog->states, &cursor, &name, &clauses)) {
+      names[i] = name;
+      rows[i] = *clauses;
+      hashes[i] = Str_Hash(name);
+      i++;
+   }
+
+   // Lay them out by index.
+   Mph *index = Mph_Build(hashes, n);
+   if (index != NULL) {
+      prog->ids = Arena_Alloc(prog->arena, n * sizeof(Str *));
+      prog->rows = Arena_Alloc(prog->arena, n * sizeof(struct clause **));
+      for (i=0; i < n; i++) {
+         int id = Mph_Index(index, hashes[i]);
+         prog->ids[id] = names[i];
+         prog->rows[id] = rows[i];
+      }
+      prog->index = index;
+   }
+   free(hashes);
+   free(names);
+   free(rows);
+}
+
+   /**
+      The clauses for the given state, or NULL if it isn't defined.
+   **/
+static struct clause **state_clauses (Program *prog, Str *state)
+{
+
+   // Our own states.
+   struct clause **clauses = NULL;
+   if (prog->index != NULL) {
+      int id = Mph_Index(prog->index, Str_Hash(state));
+      if (same_state(prog->ids[id], state))
+         clauses = prog->rows[id];
+   }
+   else {
+      struct clause ***found = StateMap_Get(prog->states, state);
+      if (found != NULL) clauses = *found;
+   }
+
+   // Once the machine has moved into an imported program, its states are
+   // that program's.
+   int i;
+   for (i=0; clauses == NULL && i < prog->num_imports; i++) {
+      if (prog->imports[i].module != NULL)
+         clauses = state_clauses(prog->imports[i].module, state);
+   }
+   return clauses;
+
 }
 
+   /**
+      Report why the program can't be changed as asked: into err, or to
+      stderr if err is NULL. Returns 0, for the caller to return.
+   **/
+static int prog_error (char *err, int err_len, char *fmt, ...)
+{
+   char msg[256];
+   va_list args;
+   va_start(args, fmt);
+   vsnprintf(msg, sizeof(msg), fmt, args);
+   va_end(args);
+   if (err != NULL)
+      snprintf(err, err_len, "%s", msg);
+   else
+      ERR_MSG("%s", msg);
+   return 0;
+}
 
+   /**
+      Give each imported program an entry state named after the import,
+      with the same clauses as the import's initial state. Going to that
+      state hands the machine over to the imported program, which then
+      runs until it halts. A state of our own with the same name wins.
+   **/
+static void link_imports (Program *prog)
+{
+   int i;
+   for (i=0; i < prog->num_imports; i++) {
+      struct import *im = &prog->imports[i];
+      if (im->module == NULL || StateMap_Contains(prog->states, im->name)) continue;
+      struct clause **entry = state_clauses(im->module, im->module->init_state);
+      if (entry != NULL)
+         StateMap_Put(prog->states, im->name, entry);
+   }
+}
 
-// Free/compare functions for map.
+
+
+// Compiled images.
 // ======================================================================
 
-void Map_FreeStr (void *s)
+static inline unsigned int ptr_hash (Str *s)
 {
-   Str *str = s;
-   Str_Free(str);
+   return (unsigned int)((uintptr_t)s >> 4) * 2654435761u;
 }
 
-int Map_CmpStr (void *v1, void *v2)
+   /**
+      Map from interned names to ids. Names are told apart by pointer, so
+      the same name in two programs gets two ids.
+   **/
+#define SAME_PTR(a, b) ((a) == (b))
+MAP_DEFINE(IdMap, Str *, int, ptr_hash, SAME_PTR)
+
+static inline long align8 (long n)
 {
-   Str *s1 = v1;
-   Str *s2 = v2;  
-   if (Str_Len(s1) != Str_Len(s2))
-      return 1;
-   return Str_Cmp(s1, s2);
+   return (n + 7) & ~7L;
 }
 
-void Map_FreeClauses (void *arr_clauses)
+   /**
+      Add prog and everything it imports (directly or not) to progs, unless
+      it's already there. Returns the new number of programs.
+   **/
+static int gather_programs (Program *prog, Program ***progs, int n)
 {
-   struct clause**clauses = (struct clause **)arr_clauses;
    int i;
-   for (i=0; clauses[i] != NULL; i++) {
-      Clause_Free(clauses[i]);
+   for (i=0; i < n; i++) {
+      if ((*progs)[i] == prog) return n;
+   }
+   *progs = realloc(*progs, (n + 1) * sizeof(Program *));
+   (*progs)[n++] = prog;
+   for (i=0; i < prog->num_imports; i++) {
+      if (prog->imports[i].module != NULL)
+         n = gather_programs(prog->imports[i].module, progs, n);
    }
-   free(arr_clauses);
+   return n;
 }
 
-unsigned int Map_HashStr (void *v1)
+   /**
+      The id for a state, giving it the next one if it hasn't got one yet.
+   **/
+static int state_id (IdMap *ids, Str **names, int *n, Str *name)
 {
-   Str *s = (Str *)v1;
+   int *found = IdMap_Get(ids, name);
+   if (found != NULL) return *found;
+   IdMap_Put(ids, name, *n);
+   names[*n] = name;
+   return (*n)++;
+}
 
-   unsigned int hash = 5381;
-   char *chars = Str_Guts(s);
-   int i;
-   
-   for (i=0; chars[i] != '\0'; i++) {
-      char c = chars[i];
-      hash = ((hash << 5) + hash) + c;
+int Prog_Save (Program *prog, int fd)
+{
+   if (!prog->finalised || prog->image != NULL)
+      return -1;
+
+   // Every program whose states the machine can reach.
+   Program **progs = NULL;
+   int num_progs = gather_programs(prog, &progs, 0);
+
+   // Give ids to the states of each program, ours first, and then to any
+   // states that are only ever gone to (such as halt). Note the symbols.
+   int max_states = 0, p;
+   for (p=0; p < num_progs; p++) {
+      max_states += StateMap_Size(progs[p]->states);
+      int cursor = 0;
+      Str *name;
+      struct clause ***clauses;
+      while (StateMap_Next(progs[p]->states, &cursor, &name, &clauses)) {
+         int i;
+         for (i=0; (*clauses)[i] != NULL; i++) max_states++;
+      }
    }
-   
-   free(chars);
-   return hash;
+   IdMap *ids = IdMap_Make(max_states + 1);
+   Str **names = malloc((max_states + 1) * sizeof(Str *));
+   struct clause ***rows = calloc(max_states + 1, sizeof(struct clause **));
+   int n = 0, num_own = 0;
+   unsigned char alphabet[256];
+   memset(alphabet, TMC_NONE, sizeof(alphabet));
+   int num_symbols = 0;
+   for (p=0; p < num_progs; p++) {
+      int cursor = 0;
+      Str *name;
+      struct clause ***clauses;
+      while (StateMap_Next(progs[p]->states, &cursor, &name, &clauses)) {
+         rows[state_id(ids, names, &n, name)] = *clauses;
+      }
+      if (p == 0) num_own = n;
+   }
+   int num_defined = n, i, j;
+   for (i=0; i < num_defined; i++) {
+      for (j=0; rows[i][j] != NULL; j++) {
+         state_id(ids, names, &n, rows[i][j]->end_state);
+         unsigned char c = rows[i][j]->input;
+         if (alphabet[c] == TMC_NONE) alphabet[c] = num_symbols++;
+      }
+   }
+   if (num_symbols == 0) num_symbols = 1;
+
+   // Lay out the image.
+   long states_off = align8(sizeof(struct tmc_header));
+   long trans_off = align8(states_off + n * sizeof(struct tmc_state));
+   long names_off = align8(trans_off + (long)n * num_symbols * sizeof(struct tmc_trans));
+   long size = names_off + Str_Len(prog->name) + 1;
+   for (i=0; i < n; i++) size += Str_Len(names[i]) + 1;
+
+   // Offsets in the image are 32 bits.
+   if (size > UINT32_MAX) {
+      free(rows);
+      free(names);
+      free(progs);
+      IdMap_Free(ids);
+      return -1;
+   }
+   char *image = calloc(1, size);
+   struct tmc_header *hdr = (struct tmc_header *)image;
+   memcpy(hdr->magic, TMC_MAGIC, 4);
+   hdr->version = TMC_VERSION;
+   hdr->byte_order = TMC_BYTE_ORDER;
+   hdr->size = size;
+   hdr->num_states = n;
+   hdr->num_own = num_own;
+   hdr->num_symbols = num_symbols;
+   hdr->init = *IdMap_Get(ids, prog->init_state);
+   hdr->num_inputs = prog->num_inputs;
+   hdr->encoding = prog->encoding;
+   hdr->states = states_off;
+   hdr->trans = trans_off;
+   memcpy(hdr->alphabet, alphabet, sizeof(alphabet));
+
+   // Names.
+   long pos = names_off;
+   hdr->name = pos;
+   memcpy(image + pos, Str_Chars(prog->name), Str_Len(prog->name));
+   pos += Str_Len(prog->name) + 1;
+   struct tmc_state *states = (struct tmc_state *)(image + states_off);
+   for (i=0; i < n; i++) {
+      states[i].name = pos;
+      states[i].len = Str_Len(names[i]);
+      states[i].hash = Str_Hash(names[i]);
+      states[i].defined = i < num_defined;
+      memcpy(image + pos, Str_Chars(names[i]), states[i].len);
+      pos += states[i].len + 1;
+   }
+
+   // Transitions.
+   struct tmc_trans *trans = (struct tmc_trans *)(image + trans_off);
+   for (i=0; i < (long)n * num_symbols; i++) {
+      trans[i].action = M_ERR;
+      trans[i].next = -1;
+   }
+   for (i=0; i < num_defined; i++) {
+      for (j=0; rows[i][j] != NULL; j++) {
+         struct clause *cl = rows[i][j];
+         struct tmc_trans *t = &trans[(long)i * num_symbols + alphabet[(unsigned char)cl->input]];
+         if (t->action != M_ERR) continue; // the first clause for an input wins.
+         t->action = cl->instruction.action;
+         t->output = cl->instruction.output;
+         t->next = *IdMap_Get(ids, cl->end_state);
+      }
+   }
+
+   // Write it out.
+   long written = 0;
+   while (written < size) {
+      ssize_t w = write(fd, image + written, size - written);
+      if (w <= 0) break;
+      written += w;
+   }
+
+   free(image);
+   free(rows);
+   free(names);
+   free(progs);
+   IdMap_Free(ids);
+   return written == size ? 0 : -1;
 }
 
+int Prog_IsImage (char *image, long len)
+{
+   return len >= 4 && memcmp(image, TMC_MAGIC, 4) == 0;
+}
 
+Program *Prog_FromImage (char *image, long len)
+{
 
+   // Check the image is one we can use, and that everything in it is in
+   // bounds, so that running it can't go wrong.
+   struct tmc_header *hdr = (struct tmc_header *)image;
+   if (!Prog_IsImage(image, len) || len < (long)sizeof(struct tmc_header) || hdr->version != TMC_VERSION
+       || hdr->byte_order != TMC_BYTE_ORDER || hdr->size > len)
+      return NULL;
+   unsigned long n = hdr->num_states, k = hdr->num_symbols;
+   if (n == 0 || k == 0 || k > 256 || n > hdr->size / sizeof(struct tmc_state)
+       || hdr->init >= n || hdr->num_own > n || hdr->encoding > ENC_SYMBOLS
+       || (hdr->num_inputs < 0 && hdr->num_inputs != PROG_ANY_INPUTS)
+       || hdr->num_inputs > PROG_MAX_INPUTS)
+      return NULL;
+   unsigned long states_end, trans_len, trans_end;
+   if (__builtin_mul_overflow(n, sizeof(struct tmc_state), &states_end)
+       || __builtin_add_overflow(states_end, hdr->states, &states_end)
+       || __builtin_mul_overflow(n * k, sizeof(struct tmc_trans), &trans_len)
+       || __builtin_add_overflow(trans_len, hdr->trans, &trans_end)
+       || states_end > hdr->size || trans_end > hdr->size
+       || hdr->name >= hdr->size || memchr(image + hdr->name, '\0', hdr->size - hdr->name) == NULL)
+      return NULL;
+   struct tmc_state *states = (struct tmc_state *)(image + hdr->states);
+   struct tmc_trans *trans = (struct tmc_trans *)(image + hdr->trans);
+   unsigned long i;
+   for (i=0; i < n; i++) {
+      if ((unsigned long)states[i].name + states[i].len >= hdr->size
+          || image[states[i].name + states[i].len] != '\0')
+         return NULL;
+   }
+   for (i=0; i < n * k; i++) {
+      if (trans[i].action > M_ERR || (trans[i].action != M_ERR && (unsigned long)trans[i].next >= n))
+         return NULL;
+   }
+   for (i=0; i < 256; i++) {
+      if (hdr->alphabet[i] != TMC_NONE && hdr->alphabet[i] >= k)
+         return NULL;
+   }
 
+   // The program uses the image in place. Only the handles for its states
+   // have to be made.
+   Program *prog = Prog_Make();
+   prog->image = hdr;
+   prog->image_len = len;
+   prog->image_states = malloc(n * sizeof(Str));
+   for (i=0; i < n; i++) {
+      Str_InitInterned(&prog->image_states[i], image + states[i].name, states[i].len,
+                       states[i].hash);
+   }
+   prog->name = Str_InternChars(prog->names, image + hdr->name, strlen(image + hdr->name));
+   prog->init_state = &prog->image_states[hdr->init];
+   prog->num_inputs = hdr->num_inputs;
+   prog->encoding = hdr->encoding;
+   prog->finalised = 1;
+   return prog;
+
+}
+
+   /**
+      The id of a state of a compiled program. The program's own handles
+      give it straight away; any other Str is looked for by name among the
+      program's own states.
+   **/
+static inline int image_id (Program *prog, Str *state)
+{
+   unsigned long n = prog->image->num_states;
+   if (state >= prog->image_states && state < prog->image_states + n)
+      return state - prog->image_states;
+   unsigned long i;
+   for (i=0; i < prog->image->num_own; i++) {
+      if (Str_Same(&prog->image_states[i], state)) return i;
+   }
+   return -1;
+}
+
+   /**
+      The transition a compiled program makes from state on input, or NULL
+      if there isn't one.
+   **/
+static inline struct tmc_trans *image_trans (Program *prog, Str *state, char input)
+{
+   int id = image_id(prog, state);
+   if (id < 0) return NULL;
+   unsigned char col = prog->image->alphabet[(unsigned char)input];
+   if (col == TMC_NONE) return NULL;
+   struct tmc_trans *row = (struct tmc_trans *)((char *)prog->image + prog->image->trans);
+   struct tmc_trans *t = &row[(long)id * prog->image->num_symbols + col];
+   return t->action == M_ERR ? NULL : t;
+}
+
+
+
+// Fingerprints.
+// ======================================================================
+
+// A fingerprint describes what a program does rather than how it is written.
+// The states reachable from the initial state are numbered in the order a
+// breadth-first search finds them, taking each state's transitions in order
+// of the symbol read. The fingerprint hashes each state's transitions in
+// terms of those numbers, so it doesn't depend on the states' names or on
+// the order their clauses were written in. States named halt all stop the
+// machine, as do states with no clauses, so they are hashed as what they do
+// rather than by number.
+
+#define FP_HALT 0xFFFFFFFFFFFFFFFFUL
+#define FP_UNDEFINED 0xFFFFFFFFFFFFFFFEUL
+#define FP_END 0xFFFFFFFFFFFFFFFDUL
+
+static inline unsigned long fp_mix (unsigned long h, unsigned long x)
+{
+   h ^= x + 0x9E3779B97F4A7C15UL + (h << 6) + (h >> 2);
+   h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9UL;
+   h = (h ^ (h >> 27)) * 0x94D049BB133111EBUL;
+   return h ^ (h >> 31);
+}
+
+   /**
+      What the state does on each symbol it has a clause for, in order of
+      the symbol: the state reads inputs[i], does instrs[i] and goes to
+      next[i]. The first clause for a symbol is the one that counts. For a
+      compiled program, symbols lists the symbols it reads, num_symbols of
+      them in order. Returns the number of clauses, or -1 if the state
+      isn't defined.
+   **/
+static int state_row (Program *prog, Str *state, unsigned char *symbols, int num_symbols,
+                      unsigned char *inputs, Instruction *instrs, Str **next)
+{
+   int n = 0, i;
+
+   // Compiled programs have the row already.
+   if (prog->image != NULL) {
+      int id = Prog_StateId(prog, state);
+      if (id < 0) return -1;
+      struct tmc_trans *row = (struct tmc_trans *)((char *)prog->image + prog->image->trans);
+      row += (long)id * prog->image->num_symbols;
+      for (i=0; i < num_symbols; i++) {
+         struct tmc_trans *t = &row[prog->image->alphabet[symbols[i]]];
+         if (t->action == M_ERR) continue;
+         inputs[n] = symbols[i];
+         instrs[n].action = t->action;
+         instrs[n].output = t->output;
+         next[n++] = &prog->image_states[t->next];
+      }
+      return n;
+   }
+
+   // Otherwise sort the clauses by symbol as they're gathered. States only
+   // have a handful of them.
+   struct clause **clauses = state_clauses(prog, state);
+   if (clauses == NULL) return -1;
+   for (; *clauses != NULL; clauses++) {
+      unsigned char c = (*clauses)->input;
+      for (i=n; i > 0 && inputs[i-1] > c; i--);
+      if (i > 0 && inputs[i-1] == c) continue;
+      memmove(inputs + i + 1, inputs + i, n - i);
+      memmove(instrs + i + 1, instrs + i, (n - i) * sizeof(Instruction));
+      memmove(next + i + 1, next + i, (n - i) * sizeof(Str *));
+      inputs[i] = c;
+      instrs[i] = (*clauses)->instruction;
+      next[i] = (*clauses)->end_state;
+      n++;
+   }
+   return n;
+}
+
+static inline int is_halt (Str *state)
+{
+   return Str_EqIgnoreCase(state, "halt");
+}
+
+   /**
+      The number of a state, numbering it next if it hasn't been seen.
+   **/
+static int canon_id (IdMap *ids, Str ***order, int *n, int *capacity, Str *state)
+{
+   int *found = IdMap_Get(ids, state);
+   if (found != NULL) return *found;
+   if (*n == *capacity) {
+      *capacity = *capacity > 0 ? *capacity * 2 : 64;
+      *order = realloc(*order, *capacity * sizeof(Str *));
+   }
+   (*order)[*n] = state;
+   IdMap_Put(ids, state, *n);
+   return (*n)++;
+}
 
+unsigned long Prog_Fingerprint (Program *prog)
+{
+   if (prog->canon != NULL)
+      return prog->fingerprint;
+
+   // The inputs go on the tape the same way.
+   unsigned long h = fp_mix(0, prog->num_inputs);
+   h = fp_mix(h, prog->encoding);
+
+   IdMap *ids = IdMap_Make(64);
+   Str **order = NULL;
+   int n = 0, capacity = 0, i, k;
+   canon_id(ids, &order, &n, &capacity, prog->init_state);
+
+   // The symbols a compiled program reads.
+   unsigned char symbols[256];
+   int num_symbols = 0;
+   for (i=0; prog->image != NULL && i < 256; i++) {
+      if (prog->image->alphabet[i] != TMC_NONE) symbols[num_symbols++] = i;
+   }
 
+   unsigned char inputs[256];
+   Instruction instrs[256];
+   Str *next[256];
+   for (i=0; i < n; i++) {
+      Str *state = order[i];
+      if (is_halt(state)) {
+         h = fp_mix(h, FP_HALT);
+         continue;
+      }
+      int num = state_row(prog, state, symbols, num_symbols, inputs, instrs, next);
+      if (num < 0) {
+         h = fp_mix(h, FP_UNDEFINED);
+         continue;
+      }
+      for (k=0; k < num; k++) {
+         unsigned long to = canon_id(ids, &order, &n, &capacity, next[k]);
+         h = fp_mix(h, inputs[k]);
+         h = fp_mix(h, instrs[k].action);
+         h = fp_mix(h, (unsigned char)instrs[k].output);
+         h = fp_mix(h, to);
+      }
+      h = fp_mix(h, FP_END);
+   }
+   IdMap_Free(ids);
 
+   prog->canon = order;
+   prog->num_canon = n;
+   prog->fingerprint = h;
+   return h;
+}
 
+int Prog_CanonicalId (Program *prog, Str *state)
+{
+   Prog_Fingerprint(prog);
+   int i;
+   for (i=0; i < prog->num_canon; i++) {
+      if (prog->canon[i] == state) return i;
+   }
+   return -1;
+}
 
+Str *Prog_CanonicalState (Program *prog, int id)
+{
+   Prog_Fingerprint(prog);
+   return id >= 0 && id < prog->num_canon ? prog->canon[id] : NULL;
+}
@@ -24,7 +24,6 @@
    #include <string.h>
 
    #include "str.h"
-   #include "map.h"
    #include "action.h"
    #include "program.h"
 
@@ -40,16 +39,35 @@
       char output;
    } Instruction;
 
+      /**
+         How a program's inputs are written onto the tape. Each input is
+         followed by a single blank.
+            ENC_UNARY : n is written as n 1s. This is the default.
+            ENC_BINARY : n is written in binary with 0s and 1s.
+            ENC_DECIMAL : n is written with the digits 0-9.
+            ENC_SYMBOLS : inputs are strings, written as they are.
+      **/
+   typedef enum { ENC_UNARY, ENC_BINARY, ENC_DECIMAL, ENC_SYMBOLS } Encoding;
+
+   // The most inputs a program can take.
+   #define PROG_MAX_INPUTS 1024
+
+   // The number of inputs of a program that takes however many it is given
+   // (such as a quintuple program that doesn't say).
+   #define PROG_ANY_INPUTS (-2)
+
 
    // Accessing functions.
    // ============================================================
 
       /**
-         These functions return metadata about the program. The Str
-         pointers returned are freshly allocated, so you should
-         free them when you're done.
+         These functions return metadata about the program. The name
+         is freshly allocated, so you should free it when you're done.
+         State names are interned (see str.h), and Prog_InitState returns
+         the program's own copy, which must not be freed.
       **/
    int Prog_NumInputs (Program *prog);
+   Encoding Prog_Encoding (Program *prog);
    Str *Prog_Name (Program *prog);
    Str *Prog_InitState (Program *prog);
 
@@ -58,6 +76,43 @@
       **/
    int Prog_IsStateDefined (Program *prog, Str *s);
 
+      /**
+         Once the program is finalised each state has an id in
+         [0, Prog_NumStates). This returns the id of the given state, or -1
+         if it isn't defined (or the program has no ids).
+      **/
+   int Prog_StateId (Program *prog, Str *s);
+
+      /**
+         Return the program's own handle for the state with the same name
+         as s, which may belong to another program (such as an earlier
+         version of this one). A state of an imported program that is
+         still imported keeps its handle. A name the program doesn't
+         define is interned with it, so a machine sitting in it stays
+         where it is. The handle belongs to the program.
+      **/
+   Str *Prog_FindState (Program *prog, Str *s);
+
+      /**
+         A program's fingerprint is a hash of what it does, which doesn't
+         depend on what its states are called or on the order their
+         clauses are written in: programs with the same fingerprint (bar
+         collisions) run the same way on the same inputs. It is worked out
+         from the states reachable from the initial state, which it
+         numbers in a canonical order, so that a state of one program can
+         be matched with a state of another with the same fingerprint.
+            Prog_Fingerprint : the program's fingerprint. It is worked out
+               the first time it is asked for, in time proportional to the
+               size of the program.
+            Prog_CanonicalId : the number of the given state (one of the
+               program's handles), or -1 if it isn't reachable.
+            Prog_CanonicalState : the program's handle for the state with
+               the given number, or NULL if there isn't one.
+      **/
+   unsigned long Prog_Fingerprint (Program *prog);
+   int Prog_CanonicalId (Program *prog, Str *state);
+   Str *Prog_CanonicalState (Program *prog, int id);
+
       /**
          Return the number of states the program has.
       **/
@@ -75,6 +130,7 @@
       /**
          Return the state that the machine should transition into after
          executing the next instruction. If there isn't one NULL is returned.
+         The state returned is interned, so it doesn't need to be freed.
             prog : the program being executed.
             state : name of the state the machine is currently in.
             input : the character being read on the tape.
@@ -88,7 +144,10 @@
 
       /**
          These functions are used for making, deleting, and allocating
-         memory for programs.
+         memory for programs. Everything a program allocates comes out of
+         one arena, so Prog_Free releases it all at once; any Str the
+         program handed out (state names from Prog_InitState and
+         Prog_NextTransition) dies with it.
       **/
    void Prog_Free (Program *pr);
    Program *Prog_Make (void);
@@ -96,6 +155,31 @@
 
 
 
+   // Compiled programs.
+   // ============================================================
+
+      /**
+         A finalised program can be compiled into an image (a .tmc file):
+         a flat, relocatable block holding its states, a dense table of
+         transitions and its metadata. Loading one doesn't parse anything,
+         and the image is used where it lies.
+            Prog_Save : write the compiled image of prog (and of everything
+               it imports) to fd. Returns 0, or -1 on failure (including
+               when the program is too big for the image's 32-bit offsets).
+            Prog_IsImage : whether the len bytes at image look like a
+               compiled image.
+            Prog_FromImage : the program in the given image, which must be
+               a mapping made with mmap; the program takes it over and
+               unmaps it when freed. Returns NULL if the image is corrupt
+               or was made by another version (the caller still owns the
+               mapping then).
+      **/
+   int Prog_Save (Program *prog, int fd);
+   int Prog_IsImage (char *image, long len);
+   Program *Prog_FromImage (char *image, long len);
+
+
+
    // Modifying functions.
    // ============================================================
 
@@ -103,10 +187,11 @@
          This finalises the program. Before finalising the contents of
          a program can be modified but they cannot be read. After
          finalising the contents of the program can no longer be
-         modified but become readable. If the program is not well-formed
-         then this will cause an error.
+         modified but become readable. Returns non-zero if the program
+         was finalised. If it isn't well-formed, returns 0 and puts the
+         reason in err (of err_len bytes), or prints it if err is NULL.
       **/
-   void Prog_Finalise (Program *pr);
+   int Prog_Finalise (Program *pr, char *err, int err_len);
 
       /**
          These functions are used for setting metadata about a given
@@ -117,6 +202,15 @@
    void Prog_SetName (Program *prog, Str *str);
    void Prog_SetInitState (Program *prog, Str *state_name);
    void Prog_SetNumInputs (Program *prog, int inputs);
+   void Prog_SetEncoding (Program *prog, Encoding encoding);
+
+      /**
+         Intern a name with the program, returning its copy. This lets a
+         caller holding the name as raw characters (such as the parser)
+         make it without allocating a Str of its own. The copy belongs to
+         the program and must not be freed.
+      **/
+   Str *Prog_Intern (Program *prog, char *chars, int len);
 
       /**
          Add a state to the program. This is done by passing in three arrays.
@@ -127,8 +221,38 @@
             inputs : the inputs for each clause.
             instrs : the instructions for each clause.
             end_states : the transition states for each clause.
+         The arrays and Strs are copied, so the caller still owns them.
       **/
    void Prog_AddState (Program *prog, Str *state_name, int num_clauses,
                        char *inputs, Instruction *instrs, Str **end_states);
 
+      /**
+         Import a finalised program under the given name. Once this
+         program is finalised, going to the state with that name hands
+         the machine over to the imported program's initial state, and
+         it runs until the imported program halts. The imported program
+         is shared rather than copied, so it has to outlive this one.
+         The module may be NULL, in which case the import is left to be
+         given with Prog_SetImport before the program is finalised.
+         Compiled programs can't be imported. Returns non-zero if the
+         import was added; otherwise returns 0 and puts the reason in err
+         (of err_len bytes), or prints it if err is NULL.
+      **/
+   int Prog_AddImport (Program *prog, Str *name, Program *module,
+                       char *err, int err_len);
+
+      /**
+         The imports of a program, so that they can be given afterwards
+         (as when a set of programs that import each other is loaded).
+            Prog_NumImports : how many imports the program has.
+            Prog_ImportName : the name of the import at index i.
+            Prog_SetImport : give the finalised program for import i,
+               reporting failure as Prog_AddImport does.
+            Prog_IsFinalised : whether the program has been finalised.
+      **/
+   int Prog_NumImports (Program *prog);
+   Str *Prog_ImportName (Program *prog, int i);
+   int Prog_SetImport (Program *prog, int i, Program *module, char *err, int err_len);
+   int Prog_IsFinalised (Program *prog);
+
 #endif
@@ -0,0 +1,413 @@
+
+// Headers.
+// ======================================================================
+
+#include <ctype.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "parser.h"
+#include "quintuple.h"
+#include "tape.h"
+
+
+// Some handy macros.
+// ======================================================================
+
+#define ERR(...) fail(data, __VA_ARGS__)
+
+#define WILD '*'
+#define BLANK_SYMBOL '_'
+
+
+// Definitions.
+// ======================================================================
+
+   /**
+      A rule that has been compiled down to a clause of the program.
+         state : the state it belongs to.
+         input : the symbol it reads, or WILD.
+         instr : what it does.
+         next : the state it goes to.
+         order : where it came in the file, so that sorting rules by state
+            keeps each state's rules in their original order.
+   **/
+struct rule {
+   Str *state;
+   char input;
+   Instruction instr;
+   Str *next;
+   int order;
+};
+
+   /**
+      The state of the parser. Rules are gathered in rules, which has room
+      for capacity of them. symbols marks every symbol the program reads or
+      writes; those are what a wildcard read stands for. Errors jump
+      back to bail, having written their message to err.
+   **/
+struct quint_data {
+   char *text;
+   long index;
+   long len;
+   int line_num;
+   Program *prog;
+   struct rule *rules;
+   int num_rules;
+   int capacity;
+   char symbols[256];
+   Str *init;
+   int num_inputs;
+   int skipped;
+   int first_skipped;
+   jmp_buf bail;
+   char *err;
+   int err_len;
+};
+
+typedef struct quint_data DATA;
+
+   /**
+      Give up on the program, with the given message.
+   **/
+static _Noreturn void fail (DATA *data, char *fmt, ...)
+{
+   va_list args;
+   va_start(args, fmt);
+   if (data->err != NULL) vsnprintf(data->err, data->err_len, fmt, args);
+   va_end(args);
+   longjmp(data->bail, 1);
+}
+
+   /**
+      A token: len characters of the text, starting at chars.
+   **/
+struct token {
+   char *chars;
+   int len;
+};
+
+typedef struct token Token;
+
+
+
+// Lexing.
+// ======================================================================
+
+   /**
+      Read the next token on the current line into tok. Returns 0 at the
+      end of the line (or at a comment).
+   **/
+static int next_token (DATA *data, Token *tok)
+{
+   while (data->index < data->len) {
+      char c = data->text[data->index];
+      if (c == '\n' || c == ';') return 0;
+      if (!isspace(c)) break;
+      data->index++;
+   }
+   if (data->index >= data->len) return 0;
+   long start = data->index;
+   while (data->index < data->len && !isspace(data->text[data->index])
+          && data->text[data->index] != ';')
+      data->index++;
+   tok->chars = data->text + start;
+   tok->len = data->index - start;
+   return 1;
+}
+
+   /**
+      Skip to the start of the next line.
+   **/
+static void next_line (DATA *data)
+{
+   char *nl = memchr(data->text + data->index, '\n', data->len - data->index);
+   data->index = nl == NULL ? data->len : nl - data->text + 1;
+   data->line_num++;
+}
+
+static int tok_eq_ignore_case (Token tok, char *s)
+{
+   return strncasecmp(tok.chars, s, tok.len) == 0 && s[tok.len] == '\0';
+}
+
+   /**
+      The symbol a one character token stands for.
+   **/
+static char tok_symbol (DATA *data, Token tok)
+{
+   if (tok.len != 1)
+      ERR("Expected a single symbol on line %d, got '%.*s'.", data->line_num,
+          tok.len, tok.chars);
+   return tok.chars[0] == BLANK_SYMBOL ? BLANK : tok.chars[0];
+}
+
+
+
+// Parsing.
+// ======================================================================
+
+static void add_rule (DATA *data, Str *state, char input, Instruction instr, Str *next)
+{
+   if (data->num_rules == data->capacity) {
+      data->capacity = data->capacity > 0 ? data->capacity * 2 : 64;
+      data->rules = realloc(data->rules, data->capacity * sizeof(struct rule));
+   }
+   struct rule *r = &data->rules[data->num_rules];
+   r->state = state;
+   r->input = input;
+   r->instr = instr;
+   r->next = next;
+   r->order = data->num_rules++;
+}
+
+   /**
+      Comments of the form "; inputs: N" and "; init: STATE" set up the
+      program; any other comment is ignored.
+   **/
+static void parse_comment (DATA *data)
+{
+   data->index++;
+   Token key, val;
+   if (!next_token(data, &key) || key.len < 2 || key.chars[key.len - 1] != ':')
+      return;
+   key.len--;
+   if (!next_token(data, &val))
+      return;
+   if (tok_eq_ignore_case(key, "inputs")) {
+      int i, n = 0;
+      for (i=0; i < val.len; i++) {
+         if (!isdigit(val.chars[i]))
+            ERR("Number of inputs should be numeric on line %d.", data->line_num);
+         n = n * 10 + (val.chars[i] - '0');
+      }
+      data->num_inputs = n;
+   }
+   else if (tok_eq_ignore_case(key, "init")) {
+      data->init = Prog_Intern(data->prog, val.chars, val.len);
+   }
+}
+
+   /**
+      Parse one rule and compile it into a clause.
+   **/
+static void parse_rule (DATA *data, Token state_tok)
+{
+   // A rule cut short is left out, as other quintuple tools do, and noted
+   // for a warning.
+   Token read_tok, write_tok, move_tok, next_tok;
+   if (!next_token(data, &read_tok) || !next_token(data, &write_tok)
+       || !next_token(data, &move_tok) || !next_token(data, &next_tok)) {
+      if (data->skipped++ == 0) data->first_skipped = data->line_num;
+      return;
+   }
+   Token extra;
+   if (next_token(data, &extra))
+      ERR("Too many fields on line %d.", data->line_num);
+
+   Str *state = Prog_Intern(data->prog, state_tok.chars, state_tok.len);
+   Str *next = Prog_Intern(data->prog, next_tok.chars, next_tok.len);
+   if (data->init == NULL)
+      data->init = state;
+
+   // Symbols; '*' writes leave the symbol alone.
+   char input = tok_symbol(data, read_tok);
+   char output = tok_symbol(data, write_tok);
+   if (input != WILD) data->symbols[(unsigned char)input] = 1;
+   if (output != WILD) data->symbols[(unsigned char)output] = 1;
+   if (output == input) output = WILD;
+
+   // Direction.
+   Action move;
+   if (move_tok.len != 1)
+      ERR("Unknown move '%.*s' on line %d.", move_tok.len, move_tok.chars, data->line_num);
+   switch (tolower(move_tok.chars[0])) {
+      case 'l': move = M_LEFT; break;
+      case 'r': move = M_RIGHT; break;
+      case '*': move = M_ERR; break; // no move.
+      default:
+         ERR("Unknown move '%.*s' on line %d.", move_tok.len, move_tok.chars,
+             data->line_num);
+   }
+
+   // Every rule is a single clause. One that neither writes nor moves
+   // still has to do something, so it writes what's there.
+   Instruction instr = { move, output };
+   if (move == M_ERR)
+      instr.action = M_PRINT;
+   else if (output == WILD)
+      instr.output = '\0';
+   else
+      instr.action = move == M_LEFT ? M_PRINT_LEFT : M_PRINT_RIGHT;
+   add_rule(data, state, input, instr, next);
+}
+
+static void parse_rules (DATA *data)
+{
+   while (data->index < data->len) {
+      Token state;
+      if (next_token(data, &state))
+         parse_rule(data, state);
+      if (data->index < data->len && data->text[data->index] == ';')
+         parse_comment(data);
+      next_line(data);
+   }
+   if (data->num_rules == 0)
+      ERR("No rules found!");
+}
+
+
+
+// Building the program.
+// ======================================================================
+
+static int cmp_rules (const void *a, const void *b)
+{
+   const struct rule *r = a, *s = b;
+   if (r->state != s->state)
+      return Str_Hash(r->state) < Str_Hash(s->state) ? -1
+           : Str_Hash(r->state) > Str_Hash(s->state) ? 1
+           : strcmp(Str_Chars(r->state), Str_Chars(s->state));
+   return r->order - s->order;
+}
+
+   /**
+      Add the state whose rules are rules[0..n) to the program. An explicit
+      rule for a symbol beats a wildcard, and the first rule for a symbol
+      beats any later ones. Wildcard reads and writes are expanded over every
+      symbol the program uses.
+   **/
+static void add_state (DATA *data, struct rule *rules, int n)
+{
+   char inputs[256];
+   Instruction instrs[256];
+   Str *ends[256];
+   char have[256];
+   memset(have, 0, sizeof(have));
+   int num = 0, i, c;
+
+   // Explicit rules first.
+   for (i=0; i < n; i++) {
+      unsigned char in = rules[i].input;
+      if (rules[i].input == WILD || have[in]) continue;
+      have[in] = 1;
+      Instruction instr = rules[i].instr;
+      if (instr.action == M_PRINT && instr.output == WILD)
+         instr.output = rules[i].input;
+      inputs[num] = rules[i].input;
+      instrs[num] = instr;
+      ends[num++] = rules[i].next;
+   }
+
+   // Then the first wildcard fills in the rest.
+   for (i=0; i < n && rules[i].input != WILD; i++);
+   if (i < n) {
+      for (c=0; c < 256; c++) {
+         if (!data->symbols[c] || have[c]) continue;
+         Instruction instr = rules[i].instr;
+         if (instr.action == M_PRINT && instr.output == WILD)
+            instr.output = c;
+         inputs[num] = c;
+         instrs[num] = instr;
+         ends[num++] = rules[i].next;
+      }
+   }
+
+   if (num > 0)
+      Prog_AddState(data->prog, rules[0].state, num, inputs, instrs, ends);
+}
+
+static void build_program (DATA *data)
+{
+   qsort(data->rules, data->num_rules, sizeof(struct rule), cmp_rules);
+   int start = 0, i;
+   for (i=1; i <= data->num_rules; i++) {
+      if (i == data->num_rules || data->rules[i].state != data->rules[start].state) {
+         add_state(data, data->rules + start, i - start);
+         start = i;
+      }
+   }
+}
+
+
+
+// Public functions.
+// ======================================================================
+
+Program *Quint_ProgFromText (char *text, long len, char *name, char *err, int err_len)
+{
+
+   // Ready the parser. Unary inputs are made of 1s and blanks, so those
+   // are always symbols.
+   DATA *data = malloc(sizeof(DATA));
+   data->text = text;
+   data->index = 0;
+   data->len = len;
+   data->line_num = 1;
+   data->prog = Prog_Make();
+   data->rules = NULL;
+   data->num_rules = 0;
+   data->capacity = 0;
+   memset(data->symbols, 0, sizeof(data->symbols));
+   data->symbols['1'] = 1;
+   data->symbols[BLANK] = 1;
+   data->init = NULL;
+   data->num_inputs = PROG_ANY_INPUTS;
+   data->skipped = 0;
+   data->err = err;
+   data->err_len = err_len;
+   if (err != NULL && err_len > 0) err[0] = '\0';
+   if (setjmp(data->bail)) {
+      Prog_Free(data->prog);
+      free(data->rules);
+      free(data);
+      return NULL;
+   }
+
+   // Parse and compile the rules.
+   parse_rules(data);
+   build_program(data);
+
+   // Set up the program's metadata and finalise it.
+   Program *prog = data->prog;
+   Prog_SetName(prog, Prog_Intern(prog, name, strlen(name)));
+   Prog_SetInitState(prog, data->init);
+   Prog_SetNumInputs(prog, data->num_inputs);
+   Prog_SetEncoding(prog, ENC_UNARY);
+   char msg[PARSE_ERR_MAX];
+   if (!Prog_Finalise(prog, msg, sizeof(msg)))
+      ERR("%s: %s", name, msg);
+
+   // Warn about any rules that were left out.
+   if (data->skipped > 0 && err != NULL)
+      snprintf(err, err_len, "%s: ignored %d incomplete rule%s, the first on line %d.",
+               name, data->skipped, data->skipped == 1 ? "" : "s", data->first_skipped);
+
+   free(data->rules);
+   free(data);
+   return prog;
+
+}
+
+int Quint_IsQuintuple (char *text, long len)
+{
+
+   // Skip whitespace and comments to the first token.
+   long i = 0;
+   while (i < len) {
+      if (text[i] == ';') {
+         while (i < len && text[i] != '\n') i++;
+      }
+      else if (isspace(text[i])) i++;
+      else break;
+   }
+
+   // The other format always starts with "keyword:".
+   while (i < len && isalnum(text[i])) i++;
+   return !(i < len && text[i] == ':');
+
+}
@@ -0,0 +1,45 @@
+
+/* This module parses programs written as quintuples, one rule per line:
+
+      state read write move next
+
+   which says that in state, reading the symbol read, the machine writes the
+   symbol write, moves the head (l for left, r for right, * to stay put) and
+   goes to state next. '_' is the blank symbol. A '*' read matches any symbol
+   that the state has no other rule for, and a '*' write leaves the symbol as
+   it is. Everything after a ';' is a comment. A state with no rules (such as
+   halt) halts the machine.
+
+   The machine starts in the state of the first rule and takes as many
+   inputs, in unary, as it is given, unless a comment says otherwise:
+
+      ; inputs: 2
+      ; init: q0
+
+   Each rule is compiled into a single clause, so it takes one step, as it
+   would on a quintuple machine. A rule that writes and moves uses one of the
+   print-and-move actions (see action.h). */
+
+#ifndef QUINTUPLE_H
+#define QUINTUPLE_H
+
+   #include "program.h"
+
+   /**
+      Return the finalised program described by text[0..len), which needn't
+      be null-terminated. The program gets the given name. If the text
+      isn't a valid program, returns NULL and writes the reason to
+      err[0..err_len) (unless err is NULL). Rules that are cut short are
+      left out; if there were any, the program is returned with a warning
+      in err.
+   **/
+   Program *Quint_ProgFromText (char *text, long len, char *name, char *err, int err_len);
+
+   /**
+      Check whether text[0..len) looks like a quintuple program rather than
+      one in the format parser.h reads: that is, whether its first rule
+      isn't a "keyword:" header line.
+   **/
+   int Quint_IsQuintuple (char *text, long len);
+
+#endif
@@ -0,0 +1,488 @@
+
+#include <limits.h>
+#include <unistd.h>
+
+#include "simd.h"
+#include "tape.h"
+
+#define CHUNK_BITS 12
+#define CHUNK_SIZE (1L << CHUNK_BITS)
+
+   /**
+      The chunked tape is a directory of fixed size chunks, indexed by
+      position / CHUNK_SIZE. The directory grows in both directions, and
+      chunks are only allocated when something is written into them; an
+      empty slot reads as blank.
+
+      Chunks and the directory are both reference counted so that tapes can
+      be forked copy-on-write. Forking shares the directory, and a tape only
+      copies it (and bumps the count on every chunk) the first time it
+      writes after a fork. Likewise a chunk is only copied when a tape writes
+      to it while it is still shared.
+   **/
+struct chunk {
+   int refs;
+   char cells[CHUNK_SIZE];
+};
+
+struct directory {
+   int refs;
+   long first; // index of the chunk in slots[0].
+   long count;
+   struct chunk **slots;
+};
+
+struct chunked_tape {
+   struct tape base;
+   struct directory *dir;
+   long lo; // extent of the cells written to.
+   long hi;
+};
+
+static char Chunked_Read (Tape *tape, long pos);
+static void Chunked_Write (Tape *tape, long pos, char c);
+static void Chunked_ReadRange (Tape *tape, long start, long len, char *buf);
+static void Chunked_WriteRange (Tape *tape, long start, long len, char *buf);
+static void Chunked_Fill (Tape *tape, long start, long len, char c);
+static void Chunked_Extent (Tape *tape, long *lo, long *hi);
+static long Chunked_Count (Tape *tape, long lo, long hi, char c);
+static int Chunked_Export (Tape *tape, long lo, long hi, int fd);
+static Tape *Chunked_Fork (Tape *tape);
+static void Chunked_Del (Tape *tape);
+
+static const struct tape_ops chunked_ops = {
+   Chunked_Read,
+   Chunked_Write,
+   Chunked_ReadRange,
+   Chunked_WriteRange,
+   Chunked_Fill,
+   Chunked_Extent,
+   Chunked_Count,
+   Chunked_Export,
+   NULL,
+   Chunked_Fork,
+   Chunked_Del
+};
+
+
+
+// Generic tape functions.
+// ============================================================
+
+char
+Tape_Read (Tape *tape, long pos)
+{
+   return tape->ops->read(tape, pos);
+}
+
+void
+Tape_Write (Tape *tape, long pos, char c)
+{
+   tape->ops->write(tape, pos, c);
+}
+
+void
+Tape_ReadRange (Tape *tape, long start, long len, char *buf)
+{
+   tape->ops->read_range(tape, start, len, buf);
+}
+
+void
+Tape_WriteRange (Tape *tape, long start, long len, char *buf)
+{
+   if (len > 0)
+      tape->ops->write_range(tape, start, len, buf);
+}
+
+void
+Tape_Fill (Tape *tape, long start, long len, char c)
+{
+   if (len > 0)
+      tape->ops->fill(tape, start, len, c);
+}
+
+void
+Tape_Extent (Tape *tape, long *lo, long *hi)
+{
+   tape->ops->extent(tape, lo, hi);
+}
+
+long
+Tape_Count (Tape *tape, long lo, long hi, char c)
+{
+   if (hi <= lo) return 0;
+   return tape->ops->count(tape, lo, hi, c);
+}
+
+int
+Tape_Export (Tape *tape, long lo, long hi, int fd)
+{
+   if (hi <= lo) return 0;
+   return tape->ops->export(tape, lo, hi, fd);
+}
+
+int
+Tape_WriteAll (int fd, struct iovec *iov, int count)
+{
+   while (count > 0) {
+      ssize_t n = writev(fd, iov, count);
+      if (n < 0) return -1;
+
+      // Skip over whatever was written, which may end part way into a buffer.
+      while (count > 0 && (size_t)n >= iov->iov_len) {
+         n -= iov->iov_len;
+         iov++;
+         count--;
+      }
+      if (count > 0) {
+         iov->iov_base = (char *)iov->iov_base + n;
+         iov->iov_len -= n;
+      }
+   }
+   return 0;
+}
+
+void
+Tape_Sync (Tape *tape)
+{
+   if (tape->ops->sync != NULL)
+      tape->ops->sync(tape);
+}
+
+Tape *
+Tape_Fork (Tape *tape)
+{
+   return tape->ops->fork(tape);
+}
+
+void
+Tape_Del (Tape *tape)
+{
+   tape->ops->del(tape);
+}
+
+
+
+// Chunks and directories.
+// ============================================================
+
+static struct chunk *
+Chunk_Make (void)
+{
+   struct chunk *chunk = malloc(sizeof (struct chunk));
+   chunk->refs = 1;
+   memset(chunk->cells, BLANK, CHUNK_SIZE);
+   return chunk;
+}
+
+static void
+Chunk_Release (struct chunk *chunk)
+{
+   if (chunk != NULL && --chunk->refs == 0)
+      free(chunk);
+}
+
+static struct directory *
+Dir_Make (long first, long count)
+{
+   struct directory *dir = malloc(sizeof (struct directory));
+   dir->refs = 1;
+   dir->first = first;
+   dir->count = count;
+   dir->slots = calloc(count, sizeof (struct chunk *));
+   return dir;
+}
+
+static void
+Dir_Release (struct directory *dir)
+{
+   if (dir->refs > 1) {
+      dir->refs--;
+      return;
+   }
+   long i;
+   for (i=0; i < dir->count; i++) {
+      Chunk_Release(dir->slots[i]);
+   }
+   free(dir->slots);
+   free(dir);
+}
+
+static inline long
+chunk_index (long pos)
+{
+   return pos >> CHUNK_BITS;
+}
+
+static inline long
+chunk_offset (long pos)
+{
+   return pos & (CHUNK_SIZE - 1);
+}
+
+   /**
+      Make sure the tape has a directory of its own, which covers the chunk
+      at index idx. Called before every write.
+   **/
+static void
+own_directory (struct chunked_tape *tape, long idx)
+{
+   struct directory *dir = tape->dir;
+   long first = dir->first;
+   long count = dir->count;
+
+   // Double the directory until it covers idx.
+   while (idx < first || idx - first >= count) {
+      if (idx < first) first -= count;
+      count *= 2;
+   }
+   if (dir->refs == 1 && count == dir->count)
+      return;
+
+   // Copy into a new directory, sharing the chunks.
+   struct directory *copy = Dir_Make(first, count);
+   long i;
+   for (i=0; i < dir->count; i++) {
+      struct chunk *chunk = dir->slots[i];
+      if (chunk != NULL) chunk->refs++;
+      copy->slots[dir->first - first + i] = chunk;
+   }
+   Dir_Release(dir);
+   tape->dir = copy;
+}
+
+
+
+// Chunked tape.
+// ============================================================
+
+Tape *
+Tape_MakeChunked (void)
+{
+   struct chunked_tape *tape = malloc(sizeof (struct chunked_tape));
+   tape->base.ops = &chunked_ops;
+   tape->dir = Dir_Make(-1, 2);
+   tape->lo = 0;
+   tape->hi = 0;
+   return &tape->base;
+}
+
+static char
+Chunked_Read (Tape *t, long pos)
+{
+   struct chunked_tape *tape = (struct chunked_tape *)t;
+   long idx = chunk_index(pos) - tape->dir->first;
+   if (idx < 0 || idx >= tape->dir->count)
+      return BLANK;
+   struct chunk *chunk = tape->dir->slots[idx];
+   if (chunk == NULL)
+      return BLANK;
+   return chunk->cells[chunk_offset(pos)];
+}
+
+   /**
+      Grow the extent of the tape to cover the positions [lo, hi).
+   **/
+static inline void
+touch (struct chunked_tape *tape, long lo, long hi)
+{
+   if (tape->lo == tape->hi) {
+      tape->lo = lo;
+      tape->hi = hi;
+      return;
+   }
+   if (lo < tape->lo) tape->lo = lo;
+   if (hi > tape->hi) tape->hi = hi;
+}
+
+   /**
+      Return the chunk with index idx, ready to be written to. The directory
+      must already be owned by the tape and cover idx.
+   **/
+static inline struct chunk *
+writable_chunk (struct chunked_tape *tape, long idx)
+{
+   struct chunk **slot = tape->dir->slots + (idx - tape->dir->first);
+   if (*slot == NULL) {
+      *slot = Chunk_Make();
+   }
+   else if ((*slot)->refs > 1) {
+      struct chunk *copy = malloc(sizeof (struct chunk));
+      copy->refs = 1;
+      memcpy(copy->cells, (*slot)->cells, CHUNK_SIZE);
+      (*slot)->refs--;
+      *slot = copy;
+   }
+   return *slot;
+}
+
+static void
+Chunked_Write (Tape *t, long pos, char c)
+{
+   struct chunked_tape *tape = (struct chunked_tape *)t;
+   own_directory(tape, chunk_index(pos));
+   touch(tape, pos, pos + 1);
+   writable_chunk(tape, chunk_index(pos))->cells[chunk_offset(pos)] = c;
+}
+
+static void
+Chunked_ReadRange (Tape *t, long start, long len, char *buf)
+{
+   struct chunked_tape *tape = (struct chunked_tape *)t;
+   struct directory *dir = tape->dir;
+
+   // Copy a chunk (or part of one) at a time.
+   while (len > 0) {
+      long idx = chunk_index(start) - dir->first;
+      long offset = chunk_offset(start);
+      long n = CHUNK_SIZE - offset;
+      if (n > len) n = len;
+
+      struct chunk *chunk = NULL;
+      if (idx >= 0 && idx < dir->count)
+         chunk = dir->slots[idx];
+      if (chunk != NULL)
+         memcpy(buf, chunk->cells + offset, n);
+      else
+         memset(buf, BLANK, n);
+
+      buf += n;
+      start += n;
+      len -= n;
+   }
+}
+
+   /**
+      Write to the cells [start, start + len) a chunk at a time. If buf is
+      not NULL the cells are copied from it, otherwise they're set to c.
+   **/
+static void
+write_chunks (struct chunked_tape *tape, long start, long len, char *buf, char c)
+{
+   own_directory(tape, chunk_index(start));
+   own_directory(tape, chunk_index(start + len - 1));
+   touch(tape, start, start + len);
+
+   while (len > 0) {
+      long offset = chunk_offset(start);
+      long n = CHUNK_SIZE - offset;
+      if (n > len) n = len;
+
+      struct chunk *chunk = writable_chunk(tape, chunk_index(start));
+      if (buf != NULL) {
+         memcpy(chunk->cells + offset, buf, n);
+         buf += n;
+      }
+      else {
+         memset(chunk->cells + offset, c, n);
+      }
+
+      start += n;
+      len -= n;
+   }
+}
+
+static void
+Chunked_WriteRange (Tape *t, long start, long len, char *buf)
+{
+   write_chunks((struct chunked_tape *)t, start, len, buf, BLANK);
+}
+
+static void
+Chunked_Fill (Tape *t, long start, long len, char c)
+{
+   write_chunks((struct chunked_tape *)t, start, len, NULL, c);
+}
+
+   /**
+      Return the cells of the chunk holding pos, or NULL if it hasn't been
+      allocated.
+   **/
+static inline char *
+chunk_cells (struct chunked_tape *tape, long pos)
+{
+   long idx = chunk_index(pos) - tape->dir->first;
+   if (idx < 0 || idx >= tape->dir->count || tape->dir->slots[idx] == NULL)
+      return NULL;
+   return tape->dir->slots[idx]->cells;
+}
+
+static long
+Chunked_Count (Tape *t, long lo, long hi, char c)
+{
+   struct chunked_tape *tape = (struct chunked_tape *)t;
+   long count = 0;
+   while (lo < hi) {
+      long offset = chunk_offset(lo);
+      long n = CHUNK_SIZE - offset;
+      if (n > hi - lo) n = hi - lo;
+
+      char *cells = chunk_cells(tape, lo);
+      if (cells != NULL)
+         count += Simd_Count(cells + offset, n, c);
+      else if (c == BLANK)
+         count += n;
+      lo += n;
+   }
+   return count;
+}
+
+static int
+Chunked_Export (Tape *t, long lo, long hi, int fd)
+{
+   struct chunked_tape *tape = (struct chunked_tape *)t;
+
+   // Unallocated chunks are written out from a chunk of blanks.
+   static char blanks[CHUNK_SIZE];
+   if (blanks[0] != BLANK)
+      memset(blanks, BLANK, CHUNK_SIZE);
+
+   // Gather up chunks and write them out IOV_MAX at a time.
+   struct iovec iov[IOV_MAX];
+   int count = 0;
+   while (lo < hi) {
+      long offset = chunk_offset(lo);
+      long n = CHUNK_SIZE - offset;
+      if (n > hi - lo) n = hi - lo;
+
+      char *cells = chunk_cells(tape, lo);
+      iov[count].iov_base = cells != NULL ? cells + offset : blanks;
+      iov[count].iov_len = n;
+      if (++count == IOV_MAX) {
+         if (Tape_WriteAll(fd, iov, count) == -1) return -1;
+         count = 0;
+      }
+      lo += n;
+   }
+   return Tape_WriteAll(fd, iov, count);
+}
+
+static void
+Chunked_Extent (Tape *t, long *lo, long *hi)
+{
+   struct chunked_tape *tape = (struct chunked_tape *)t;
+   *lo = tape->lo;
+   *hi = tape->hi;
+}
+
+static Tape *
+Chunked_Fork (Tape *t)
+{
+   struct chunked_tape *tape = (struct chunked_tape *)t;
+   struct chunked_tape *fork = malloc(sizeof (struct chunked_tape));
+   fork->base.ops = &chunked_ops;
+   fork->dir = tape->dir;
+   fork->dir->refs++;
+   fork->lo = tape->lo;
+   fork->hi = tape->hi;
+   return &fork->base;
+}
+
+static void
+Chunked_Del (Tape *t)
+{
+   struct chunked_tape *tape = (struct chunked_tape *)t;
+   Dir_Release(tape->dir);
+   tape->dir = NULL;
+   free(tape);
+}
@@ -0,0 +1,118 @@
+
+/* A tape is the storage underneath a machine. It is doubly infinite: every
+   cell that has never been written reads as blank. Cells are addressed by
+   their absolute position, where position 0 is the cell the head starts on.
+
+   There is more than one way to store a tape, so each backend provides a
+   table of operations (struct tape_ops) and embeds a struct tape as its
+   first member. A machine only ever talks to its tape through these
+   operations. The backends are:
+
+      chunked : a directory of heap-allocated chunks. This is the default
+         and is fine for anything that fits comfortably in RAM. Chunks are
+         shared copy-on-write between forks, so forking is O(1).
+      mapped : a sparse file mapped into memory with mmap. The kernel pages
+         cold parts of the tape out to disk, so the tape can be much larger
+         than RAM, and after Tape_Sync the file is a durable image of the
+         tape.
+      rle : runs of repeated symbols kept in a balanced tree. Unary inputs
+         and outputs are long runs of the same symbol, so a tape holding a
+         number in the billions is only a few runs. */
+
+#ifndef TAPE_H
+#define TAPE_H
+
+   #include <stdlib.h>
+   #include <string.h>
+   #include <sys/uio.h>
+
+   #define BLANK 32
+
+   // The most iovecs a single writev call will take.
+   #ifndef IOV_MAX
+   #define IOV_MAX 1024
+   #endif
+
+   typedef struct tape Tape;
+
+   struct tape_ops {
+      char (*read) (Tape *tape, long pos);
+      void (*write) (Tape *tape, long pos, char c);
+      void (*read_range) (Tape *tape, long start, long len, char *buf);
+      void (*write_range) (Tape *tape, long start, long len, char *buf);
+      void (*fill) (Tape *tape, long start, long len, char c);
+      void (*extent) (Tape *tape, long *lo, long *hi);
+      long (*count) (Tape *tape, long lo, long hi, char c);
+      int (*export) (Tape *tape, long lo, long hi, int fd);
+      void (*sync) (Tape *tape);
+      Tape *(*fork) (Tape *tape);
+      void (*del) (Tape *tape);
+   };
+
+   struct tape {
+      const struct tape_ops *ops;
+   };
+
+      /** Functions for allocating/freeing tapes. Tape_MakeMapped returns a
+          null pointer if the backing file could not be created. If path is
+          NULL it uses an anonymous temporary file. Tape_OpenMapped loads an
+          existing tape image (as left by Tape_Sync) onto a temporary tape,
+          sharing its blocks where the filesystem can, and leaves the image
+          as it was. It returns a null pointer if the file isn't one.
+          Deleting a mapped tape syncs it first if its file was named;
+          temporary tapes (including forks and loaded images) are just
+          dropped. **/
+   Tape *Tape_MakeChunked (void);
+   Tape *Tape_MakeMapped (char *path);
+   Tape *Tape_OpenMapped (char *path);
+   Tape *Tape_MakeRle (void);
+   void Tape_Del (Tape *tape);
+
+      /** Read/write the cell at the given absolute position. **/
+   char Tape_Read (Tape *tape, long pos);
+   void Tape_Write (Tape *tape, long pos, char c);
+
+      /** Copy the len cells starting at position start into buf. This
+          copies whole chunks/runs at a time, so it costs O(len) however far
+          the window is from the last access. **/
+   void Tape_ReadRange (Tape *tape, long start, long len, char *buf);
+
+      /** Bulk writes: copy len cells from buf onto the tape starting at
+          position start, or set len cells starting at start to c. These
+          size the tape once and then copy/memset whole chunks (or splice
+          whole runs), so they are far cheaper than writing cell by cell. **/
+   void Tape_WriteRange (Tape *tape, long start, long len, char *buf);
+   void Tape_Fill (Tape *tape, long start, long len, char c);
+
+      /** Get the region of tape that has been written to, as the positions
+          [lo, hi). Every cell outside the region is blank; cells inside it
+          may be blank too. If nothing has been written then lo == hi. **/
+   void Tape_Extent (Tape *tape, long *lo, long *hi);
+
+      /** Count the cells in [lo, hi) which hold c. This works directly on
+          the tape's storage: whole chunks are scanned with SIMD compares and
+          popcounts, and runs are counted without looking at their cells. **/
+   long Tape_Count (Tape *tape, long lo, long hi, char c);
+
+      /** Write the cells [lo, hi) to the file descriptor fd. Chunked and
+          run-length encoded tapes hand their storage straight to writev
+          without copying it. Returns 0 on success and -1 on an IO error. **/
+   int Tape_Export (Tape *tape, long lo, long hi, int fd);
+
+      /** Return an independent copy of the tape. Writes to either tape
+          are not seen by the other. How cheap this is depends on the
+          backend: chunked tapes share chunks copy-on-write, run-length
+          encoded tapes copy their runs, and mapped tapes copy their file
+          (which is a reflink on filesystems that support it). **/
+   Tape *Tape_Fork (Tape *tape);
+
+      /** Flush the tape to its backing store, if it has one. For a mapped
+          tape this writes the header and msyncs the mapping, after which the
+          file holds a complete image of the tape. **/
+   void Tape_Sync (Tape *tape);
+
+      /** Helper for backends: write out every buffer in iov, retrying after
+          short writes. Returns 0 on success and -1 on an IO error. **/
+   int Tape_WriteAll (int fd, struct iovec *iov, int count);
+
+#endif
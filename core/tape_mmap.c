@@ -0,0 +1,447 @@
+
+/* A tape backed by a sparse file that is mapped into memory. The file starts
+   with a one page header recording which positions the rest of the file
+   holds, followed by the cells themselves in order. Cells are stored XORed
+   with BLANK so that holes in the sparse file (which read as zero bytes) are
+   blank cells, and untouched tape never costs any disk space.
+
+   The tape grows to the right by extending the file, and to the left by
+   inserting a range at the front of the cell area. Either way the capacity
+   at least doubles, so regrowth is amortised over the cells written. */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "simd.h"
+#include "tape.h"
+
+#define HEADER_SIZE 4096
+#define INITIAL_CELLS (1L << 20)
+#define MAGIC "TMTAPE1"
+#define EXPORT_SIZE 65536
+
+struct mapped_header {
+   char magic[8];
+   int64_t lo;
+   int64_t cap;
+   int64_t written_lo;
+   int64_t written_hi;
+};
+
+struct mapped_tape {
+   struct tape base;
+   int fd;
+   char *map;
+   long lo; // position of the first cell in the file.
+   long cap; // number of cells in the file.
+   long written_lo; // extent of the cells written to.
+   long written_hi;
+   int named; // whether the file is one the user named, to be kept.
+};
+
+static char Mapped_Read (Tape *tape, long pos);
+static void Mapped_Write (Tape *tape, long pos, char c);
+static void Mapped_ReadRange (Tape *tape, long start, long len, char *buf);
+static void Mapped_WriteRange (Tape *tape, long start, long len, char *buf);
+static void Mapped_Fill (Tape *tape, long start, long len, char c);
+static void Mapped_Extent (Tape *tape, long *lo, long *hi);
+static long Mapped_Count (Tape *tape, long lo, long hi, char c);
+static int Mapped_Export (Tape *tape, long lo, long hi, int fd);
+static void Mapped_Sync (Tape *tape);
+static Tape *Mapped_Fork (Tape *tape);
+static void Mapped_Del (Tape *tape);
+
+static const struct tape_ops mapped_ops = {
+   Mapped_Read,
+   Mapped_Write,
+   Mapped_ReadRange,
+   Mapped_WriteRange,
+   Mapped_Fill,
+   Mapped_Extent,
+   Mapped_Count,
+   Mapped_Export,
+   Mapped_Sync,
+   Mapped_Fork,
+   Mapped_Del
+};
+
+
+
+// Internal functions.
+// ============================================================
+
+static inline char *
+cells (struct mapped_tape *tape)
+{
+   return tape->map + HEADER_SIZE;
+}
+
+   /**
+      Map the whole file into memory. Returns zero on failure.
+   **/
+static int
+map_file (struct mapped_tape *tape)
+{
+   void *map = mmap(NULL, HEADER_SIZE + tape->cap, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, tape->fd, 0);
+   if (map == MAP_FAILED) {
+      tape->map = NULL;
+      return 0;
+   }
+   tape->map = map;
+   return 1;
+}
+
+static inline long
+round_up (long n)
+{
+   return (n + HEADER_SIZE - 1) / HEADER_SIZE * HEADER_SIZE;
+}
+
+   /**
+      Grow the file so that it holds pos. Aborts if the file can't be grown,
+      since the machine has nowhere else to put the cell.
+   **/
+static void
+grow (struct mapped_tape *tape, long pos)
+{
+   long extra = tape->cap;
+   munmap(tape->map, HEADER_SIZE + tape->cap);
+
+   // Grow to the right by extending the file.
+   if (pos - tape->lo >= tape->cap) {
+      long needed = pos - tape->lo - tape->cap + 1;
+      if (extra < needed)
+         extra = round_up(needed);
+      if (ftruncate(tape->fd, HEADER_SIZE + tape->cap + extra) == -1)
+         goto err;
+   }
+
+   // Grow to the left by inserting a hole in front of the cells. Fall back
+   // to moving everything along if the filesystem can't insert ranges.
+   else {
+      if (extra < tape->lo - pos)
+         extra = round_up(tape->lo - pos);
+      int inserted = 0;
+#ifdef FALLOC_FL_INSERT_RANGE
+      inserted = fallocate(tape->fd, FALLOC_FL_INSERT_RANGE,
+                           HEADER_SIZE, extra) == 0;
+#endif
+      if (!inserted) {
+         if (ftruncate(tape->fd, HEADER_SIZE + tape->cap + extra) == -1)
+            goto err;
+         tape->cap += extra;
+         if (!map_file(tape)) goto err;
+         memmove(cells(tape) + extra, cells(tape), tape->cap - extra);
+         memset(cells(tape), 0, extra);
+         munmap(tape->map, HEADER_SIZE + tape->cap);
+         tape->cap -= extra;
+      }
+      tape->lo -= extra;
+   }
+
+   tape->cap += extra;
+   if (!map_file(tape)) goto err;
+   return;
+
+   err:
+      perror("Error growing mapped tape");
+      abort();
+}
+
+   /**
+      Make a tape over an open file, sizing the file to hold cap cells. The
+      file is sparse so this costs nothing on disk. Returns NULL on failure.
+   **/
+static struct mapped_tape *
+open_tape (int fd, long lo, long cap)
+{
+   if (fd == -1)
+      return NULL;
+   struct mapped_tape *tape = malloc(sizeof (struct mapped_tape));
+   tape->base.ops = &mapped_ops;
+   tape->fd = fd;
+   tape->cap = cap;
+   tape->lo = lo;
+   tape->written_lo = 0;
+   tape->written_hi = 0;
+   tape->named = 0;
+   if (ftruncate(fd, HEADER_SIZE + tape->cap) == -1 || !map_file(tape)) {
+      close(fd);
+      free(tape);
+      return NULL;
+   }
+   return tape;
+}
+
+   /**
+      Fill the cells of tape from those of the tape file open on fd, which
+      holds at least as many. The kernel copies them across (sharing extents
+      where the filesystem can), or they are read by hand if it won't.
+   **/
+static void
+copy_cells (int fd, struct mapped_tape *tape)
+{
+   loff_t in = HEADER_SIZE, out = HEADER_SIZE;
+   long copied = 0;
+   while (copied < tape->cap) {
+      ssize_t n = copy_file_range(fd, &in, tape->fd, &out, tape->cap - copied, 0);
+      if (n <= 0) break;
+      copied += n;
+   }
+   while (copied < tape->cap) {
+      ssize_t n = pread(fd, cells(tape) + copied, tape->cap - copied, HEADER_SIZE + copied);
+      if (n <= 0) break;
+      copied += n;
+   }
+}
+
+   /**
+      Open an anonymous temporary file.
+   **/
+static int
+temp_file (void)
+{
+   char tmp[] = "/tmp/tapeXXXXXX";
+   int fd = mkstemp(tmp);
+   if (fd != -1) unlink(tmp);
+   return fd;
+}
+
+
+
+// Tape operations.
+// ============================================================
+
+Tape *
+Tape_MakeMapped (char *path)
+{
+
+   // Open the backing file. Without a path, use an anonymous temporary file.
+   int fd;
+   if (path != NULL)
+      fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+   else
+      fd = temp_file();
+
+   // Start the head in the middle of the file.
+   struct mapped_tape *tape = open_tape(fd, -(INITIAL_CELLS/2), INITIAL_CELLS);
+   if (tape == NULL)
+      return NULL;
+   tape->named = path != NULL;
+   return &tape->base;
+
+}
+
+Tape *
+Tape_OpenMapped (char *path)
+{
+
+   // Check the file is a tape image, and that it's as big as its header
+   // says, so a corrupt header can't have the tape made any size.
+   struct mapped_header header;
+   struct stat st;
+   int fd = open(path, O_RDONLY);
+   if (fd == -1)
+      return NULL;
+   if (fstat(fd, &st) == -1
+       || pread(fd, &header, sizeof header, 0) != sizeof header
+       || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+       || st.st_size < HEADER_SIZE || header.cap <= 0
+       || (uint64_t)header.cap > (uint64_t)(st.st_size - HEADER_SIZE)
+       || header.written_lo > header.written_hi) {
+      close(fd);
+      return NULL;
+   }
+
+   // Copy it onto a temporary tape, picking up where the image left off.
+   // The image itself is left as it was.
+   struct mapped_tape *tape = open_tape(temp_file(), header.lo, header.cap);
+   if (tape != NULL) {
+      copy_cells(fd, tape);
+      tape->written_lo = header.written_lo;
+      tape->written_hi = header.written_hi;
+   }
+   close(fd);
+   return tape != NULL ? &tape->base : NULL;
+
+}
+
+static char
+Mapped_Read (Tape *t, long pos)
+{
+   struct mapped_tape *tape = (struct mapped_tape *)t;
+   if (pos < tape->lo || pos - tape->lo >= tape->cap)
+      return BLANK;
+   return cells(tape)[pos - tape->lo] ^ BLANK;
+}
+
+   /**
+      Make sure the file holds the positions [lo, hi), and grow the extent
+      of the tape to cover them.
+   **/
+static void
+touch (struct mapped_tape *tape, long lo, long hi)
+{
+   if (lo < tape->lo)
+      grow(tape, lo);
+   if (hi - 1 - tape->lo >= tape->cap)
+      grow(tape, hi - 1);
+
+   if (tape->written_lo == tape->written_hi) {
+      tape->written_lo = lo;
+      tape->written_hi = hi;
+      return;
+   }
+   if (lo < tape->written_lo) tape->written_lo = lo;
+   if (hi > tape->written_hi) tape->written_hi = hi;
+}
+
+static void
+Mapped_Write (Tape *t, long pos, char c)
+{
+   struct mapped_tape *tape = (struct mapped_tape *)t;
+   touch(tape, pos, pos + 1);
+   cells(tape)[pos - tape->lo] = c ^ BLANK;
+}
+
+static void
+Mapped_WriteRange (Tape *t, long start, long len, char *buf)
+{
+   struct mapped_tape *tape = (struct mapped_tape *)t;
+   touch(tape, start, start + len);
+   char *dst = cells(tape) + (start - tape->lo);
+   long i;
+   for (i=0; i < len; i++) {
+      dst[i] = buf[i] ^ BLANK;
+   }
+}
+
+static void
+Mapped_Fill (Tape *t, long start, long len, char c)
+{
+   struct mapped_tape *tape = (struct mapped_tape *)t;
+   touch(tape, start, start + len);
+   memset(cells(tape) + (start - tape->lo), c ^ BLANK, len);
+}
+
+static void
+Mapped_ReadRange (Tape *t, long start, long len, char *buf)
+{
+   struct mapped_tape *tape = (struct mapped_tape *)t;
+
+   // Work out which part of the window is in the file.
+   long from = start < tape->lo ? tape->lo : start;
+   long to = start + len;
+   if (to - tape->lo > tape->cap) to = tape->lo + tape->cap;
+   if (from >= to) {
+      memset(buf, BLANK, len);
+      return;
+   }
+
+   // Everything outside the file is blank. The loop over the file has no
+   // branches so the compiler vectorises the XOR.
+   memset(buf, BLANK, from - start);
+   char *src = cells(tape) + (from - tape->lo);
+   char *dst = buf + (from - start);
+   long i;
+   for (i=0; i < to - from; i++) {
+      dst[i] = src[i] ^ BLANK;
+   }
+   memset(dst + (to - from), BLANK, start + len - to);
+}
+
+static void
+Mapped_Extent (Tape *t, long *lo, long *hi)
+{
+   struct mapped_tape *tape = (struct mapped_tape *)t;
+   *lo = tape->written_lo;
+   *hi = tape->written_hi;
+}
+
+static long
+Mapped_Count (Tape *t, long lo, long hi, char c)
+{
+   struct mapped_tape *tape = (struct mapped_tape *)t;
+
+   // Cells outside the file are blank. Inside it, count the stored form of
+   // c, which saves translating the cells back.
+   long from = lo < tape->lo ? tape->lo : lo;
+   long to = hi - tape->lo > tape->cap ? tape->lo + tape->cap : hi;
+   if (from >= to)
+      return c == BLANK ? hi - lo : 0;
+   long count = Simd_Count(cells(tape) + (from - tape->lo), to - from, c ^ BLANK);
+   if (c == BLANK)
+      count += (from - lo) + (hi - to);
+   return count;
+}
+
+static int
+Mapped_Export (Tape *t, long lo, long hi, int fd)
+{
+
+   // The cells have to be translated back before they're written, so this
+   // goes through a buffer.
+   char *buffer = malloc(EXPORT_SIZE);
+   struct iovec iov;
+   int result = 0;
+   while (lo < hi && result == 0) {
+      long n = hi - lo < EXPORT_SIZE ? hi - lo : EXPORT_SIZE;
+      Mapped_ReadRange(t, lo, n, buffer);
+      iov.iov_base = buffer;
+      iov.iov_len = n;
+      result = Tape_WriteAll(fd, &iov, 1);
+      lo += n;
+   }
+   free(buffer);
+   return result;
+
+}
+
+static void
+Mapped_Sync (Tape *t)
+{
+   struct mapped_tape *tape = (struct mapped_tape *)t;
+   struct mapped_header *header = (struct mapped_header *)tape->map;
+   memcpy(header->magic, MAGIC, sizeof(MAGIC));
+   header->lo = tape->lo;
+   header->cap = tape->cap;
+   header->written_lo = tape->written_lo;
+   header->written_hi = tape->written_hi;
+   msync(tape->map, HEADER_SIZE + tape->cap, MS_SYNC);
+}
+
+static Tape *
+Mapped_Fork (Tape *t)
+{
+   struct mapped_tape *tape = (struct mapped_tape *)t;
+   struct mapped_tape *fork = open_tape(temp_file(), tape->lo, tape->cap);
+   if (fork == NULL) {
+      perror("Error forking mapped tape");
+      abort();
+   }
+   fork->written_lo = tape->written_lo;
+   fork->written_hi = tape->written_hi;
+   copy_cells(tape->fd, fork);
+   return &fork->base;
+}
+
+static void
+Mapped_Del (Tape *t)
+{
+   struct mapped_tape *tape = (struct mapped_tape *)t;
+
+   // Only a file the user named outlives the tape, so only it is worth
+   // writing back. Temporary and forked tapes are just dropped.
+   if (tape->named)
+      Mapped_Sync(t);
+   munmap(tape->map, HEADER_SIZE + tape->cap);
+   close(tape->fd);
+   free(tape);
+}
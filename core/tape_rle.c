@@ -0,0 +1,565 @@
+
+/* A run-length encoded tape. The tape is stored as a set of runs, each one a
+   symbol repeated some number of times. Blank cells are never stored: any
+   position not covered by a run is blank. The runs live in a treap keyed on
+   their starting position, and are also threaded into a doubly linked list
+   in tape order.
+
+   The tape keeps a cursor on the run it last touched. Machines move one cell
+   at a time, so nearly every access lands in the cursor's run or one of its
+   neighbours and is a couple of comparisons. Anything else falls back to a
+   search down the treap. Writes split runs and merge neighbouring runs with
+   the same symbol, so long unary inputs stay a handful of runs. */
+
+#include <limits.h>
+
+#include "tape.h"
+
+#define FILL_SIZE 65536
+
+struct run {
+   long start;
+   long len;
+   char sym;
+   unsigned int priority;
+   struct run *left;
+   struct run *right;
+   struct run *prev;
+   struct run *next;
+};
+
+struct rle_tape {
+   struct tape base;
+   struct run *root;
+   struct run *cursor; // last run touched, or NULL.
+   unsigned int seed;
+};
+
+static char Rle_Read (Tape *tape, long pos);
+static void Rle_Write (Tape *tape, long pos, char c);
+static void Rle_ReadRange (Tape *tape, long start, long len, char *buf);
+static void Rle_WriteRange (Tape *tape, long start, long len, char *buf);
+static void Rle_Fill (Tape *tape, long start, long len, char c);
+static void Rle_Extent (Tape *tape, long *lo, long *hi);
+static long Rle_Count (Tape *tape, long lo, long hi, char c);
+static int Rle_Export (Tape *tape, long lo, long hi, int fd);
+static Tape *Rle_Fork (Tape *tape);
+static void Rle_Del (Tape *tape);
+
+static const struct tape_ops rle_ops = {
+   Rle_Read,
+   Rle_Write,
+   Rle_ReadRange,
+   Rle_WriteRange,
+   Rle_Fill,
+   Rle_Extent,
+   Rle_Count,
+   Rle_Export,
+   NULL,
+   Rle_Fork,
+   Rle_Del
+};
+
+
+
+// Treap operations.
+// ============================================================
+
+static inline unsigned int
+next_priority (struct rle_tape *tape)
+{
+   unsigned int x = tape->seed;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   tape->seed = x;
+   return x;
+}
+
+static inline long
+run_end (struct run *run)
+{
+   return run->start + run->len;
+}
+
+static struct run *
+rotate_right (struct run *node)
+{
+   struct run *l = node->left;
+   node->left = l->right;
+   l->right = node;
+   return l;
+}
+
+static struct run *
+rotate_left (struct run *node)
+{
+   struct run *r = node->right;
+   node->right = r->left;
+   r->left = node;
+   return r;
+}
+
+static struct run *
+treap_insert (struct run *node, struct run *run)
+{
+   if (node == NULL)
+      return run;
+   if (run->start < node->start) {
+      node->left = treap_insert(node->left, run);
+      if (node->left->priority > node->priority)
+         node = rotate_right(node);
+   }
+   else {
+      node->right = treap_insert(node->right, run);
+      if (node->right->priority > node->priority)
+         node = rotate_left(node);
+   }
+   return node;
+}
+
+static struct run *
+treap_remove (struct run *node, struct run *run)
+{
+   if (node == run) {
+      if (node->left == NULL) return node->right;
+      if (node->right == NULL) return node->left;
+      if (node->left->priority > node->right->priority) {
+         node = rotate_right(node);
+         node->right = treap_remove(node->right, run);
+      }
+      else {
+         node = rotate_left(node);
+         node->left = treap_remove(node->left, run);
+      }
+   }
+   else if (run->start < node->start) {
+      node->left = treap_remove(node->left, run);
+   }
+   else {
+      node->right = treap_remove(node->right, run);
+   }
+   return node;
+}
+
+static void
+treap_free (struct run *node)
+{
+   if (node == NULL) return;
+   treap_free(node->left);
+   treap_free(node->right);
+   free(node);
+}
+
+
+
+// Run operations.
+// ============================================================
+
+   /**
+      Find the last run starting at or before pos. Returns NULL if every run
+      starts after pos. Tries the cursor and its neighbours before searching.
+   **/
+static struct run *
+find (struct rle_tape *tape, long pos)
+{
+   struct run *run = tape->cursor;
+   if (run != NULL) {
+      if (run->start > pos && run->prev != NULL && run->prev->start <= pos)
+         run = run->prev;
+      else if (run->start <= pos && run->next != NULL && run->next->start <= pos)
+         run = run->next;
+      if (run->start <= pos && (run->next == NULL || run->next->start > pos))
+         return run;
+   }
+
+   struct run *node = tape->root;
+   struct run *best = NULL;
+   while (node != NULL) {
+      if (node->start <= pos) {
+         best = node;
+         node = node->right;
+      }
+      else {
+         node = node->left;
+      }
+   }
+   return best;
+}
+
+static struct run *
+first_run (struct rle_tape *tape)
+{
+   struct run *run = tape->root;
+   while (run != NULL && run->left != NULL) run = run->left;
+   return run;
+}
+
+static struct run *
+add_run (struct rle_tape *tape, struct run *prev, long start, long len, char sym)
+{
+   struct run *run = malloc(sizeof (struct run));
+   run->start = start;
+   run->len = len;
+   run->sym = sym;
+   run->priority = next_priority(tape);
+   run->left = NULL;
+   run->right = NULL;
+
+   // Thread into the list after prev.
+   run->prev = prev;
+   if (prev != NULL) {
+      run->next = prev->next;
+      prev->next = run;
+   }
+   else {
+      run->next = first_run(tape);
+   }
+   if (run->next != NULL) run->next->prev = run;
+
+   tape->root = treap_insert(tape->root, run);
+   return run;
+}
+
+static void
+remove_run (struct rle_tape *tape, struct run *run)
+{
+   tape->root = treap_remove(tape->root, run);
+   if (run->prev != NULL) run->prev->next = run->next;
+   if (run->next != NULL) run->next->prev = run->prev;
+   if (tape->cursor == run)
+      tape->cursor = run->prev != NULL ? run->prev : run->next;
+   free(run);
+}
+
+   /**
+      Blank out the cell at pos, which lies inside run. Returns the last run
+      starting before pos afterwards (possibly NULL).
+   **/
+static struct run *
+carve (struct rle_tape *tape, struct run *run, long pos)
+{
+   struct run *prev = run->prev;
+
+   if (run->len == 1) {
+      remove_run(tape, run);
+      return prev;
+   }
+   if (pos == run->start) {
+      run->start++; // still sorts between its neighbours.
+      run->len--;
+      return prev;
+   }
+   if (pos == run_end(run) - 1) {
+      run->len--;
+      return run;
+   }
+
+   // Split the run in two around pos.
+   long right_len = run_end(run) - pos - 1;
+   run->len = pos - run->start;
+   add_run(tape, run, pos + 1, right_len, run->sym);
+   return run;
+}
+
+   /**
+      Put c into the blank cell at pos, merging with whichever neighbours
+      hold the same symbol. prev is the last run starting before pos.
+   **/
+static struct run *
+place (struct rle_tape *tape, struct run *prev, long pos, char c)
+{
+   struct run *next = prev != NULL ? prev->next : find(tape, pos + 1);
+   int join_prev = prev != NULL && run_end(prev) == pos && prev->sym == c;
+   int join_next = next != NULL && next->start == pos + 1 && next->sym == c;
+
+   if (join_prev && join_next) {
+      prev->len += 1 + next->len;
+      remove_run(tape, next);
+      return prev;
+   }
+   if (join_prev) {
+      prev->len++;
+      return prev;
+   }
+   if (join_next) {
+      next->start--;
+      next->len++;
+      return next;
+   }
+   return add_run(tape, prev, pos, 1, c);
+}
+
+
+   /**
+      Blank out the cells [start, end). Returns the last run starting before
+      start afterwards (possibly NULL).
+   **/
+static struct run *
+clear (struct rle_tape *tape, long start, long end)
+{
+   struct run *prev = find(tape, start);
+
+   // Cut back a run hanging over the start, keeping any part past the end.
+   if (prev != NULL && prev->start == start) {
+      prev = prev->prev;
+   }
+   else if (prev != NULL && run_end(prev) > start) {
+      if (run_end(prev) > end)
+         add_run(tape, prev, end, run_end(prev) - end, prev->sym);
+      prev->len = start - prev->start;
+   }
+
+   // Remove runs starting inside the range, or trim the last one.
+   struct run *run = prev != NULL ? prev->next : first_run(tape);
+   while (run != NULL && run->start < end) {
+      struct run *next = run->next;
+      if (run_end(run) > end) {
+         run->len = run_end(run) - end;
+         run->start = end;
+         break;
+      }
+      remove_run(tape, run);
+      run = next;
+   }
+   return prev;
+}
+
+   /**
+      Merge run with the run after it if they touch and hold the same symbol.
+   **/
+static void
+join (struct rle_tape *tape, struct run *run)
+{
+   struct run *next = run != NULL ? run->next : NULL;
+   if (next != NULL && run_end(run) == next->start && run->sym == next->sym) {
+      run->len += next->len;
+      remove_run(tape, next);
+   }
+}
+
+   /**
+      Replace the cells [start, start + len) with runs. If buf is not NULL the
+      runs are taken from it, otherwise the whole range is one run of c.
+   **/
+static void
+splice (struct rle_tape *tape, long start, long len, char *buf, char c)
+{
+   struct run *before = clear(tape, start, start + len);
+   struct run *last = before;
+
+   long i = 0;
+   while (i < len) {
+      char sym = buf != NULL ? buf[i] : c;
+      long n = 1;
+      if (buf == NULL)
+         n = len;
+      else
+         while (i + n < len && buf[i + n] == sym) n++;
+      if (sym != BLANK)
+         last = add_run(tape, last, start + i, n, sym);
+      i += n;
+   }
+
+   // Merge with the neighbours at either end of the range.
+   join(tape, last);
+   if (before != last) join(tape, before);
+   tape->cursor = before != NULL ? before : first_run(tape);
+}
+
+
+
+// Tape operations.
+// ============================================================
+
+Tape *
+Tape_MakeRle (void)
+{
+   struct rle_tape *tape = malloc(sizeof (struct rle_tape));
+   tape->base.ops = &rle_ops;
+   tape->root = NULL;
+   tape->cursor = NULL;
+   tape->seed = 2463534242u;
+   return &tape->base;
+}
+
+static char
+Rle_Read (Tape *t, long pos)
+{
+   struct rle_tape *tape = (struct rle_tape *)t;
+   struct run *run = find(tape, pos);
+   if (run == NULL)
+      return BLANK;
+   tape->cursor = run;
+   return pos < run_end(run) ? run->sym : BLANK;
+}
+
+static void
+Rle_Write (Tape *t, long pos, char c)
+{
+   struct rle_tape *tape = (struct rle_tape *)t;
+   struct run *run = find(tape, pos);
+   int covered = run != NULL && pos < run_end(run);
+
+   // Nothing to do if the cell already holds c.
+   if (covered ? run->sym == c : c == BLANK)
+      return;
+
+   if (covered)
+      run = carve(tape, run, pos);
+   if (c != BLANK)
+      run = place(tape, run, pos, c);
+   tape->cursor = run;
+}
+
+static void
+Rle_ReadRange (Tape *t, long start, long len, char *buf)
+{
+   struct rle_tape *tape = (struct rle_tape *)t;
+   long end = start + len;
+   memset(buf, BLANK, len);
+
+   // Fill in each run overlapping the window.
+   struct run *run = find(tape, start);
+   if (run == NULL)
+      run = first_run(tape);
+   for (; run != NULL && run->start < end; run = run->next) {
+      long from = run->start > start ? run->start : start;
+      long to = run_end(run) < end ? run_end(run) : end;
+      if (from < to)
+         memset(buf + (from - start), run->sym, to - from);
+   }
+}
+
+static void
+Rle_WriteRange (Tape *t, long start, long len, char *buf)
+{
+   splice((struct rle_tape *)t, start, len, buf, BLANK);
+}
+
+static void
+Rle_Fill (Tape *t, long start, long len, char c)
+{
+   splice((struct rle_tape *)t, start, len, NULL, c);
+}
+
+static void
+Rle_Extent (Tape *t, long *lo, long *hi)
+{
+   struct rle_tape *tape = (struct rle_tape *)t;
+   struct run *first = tape->root;
+   struct run *last = tape->root;
+   if (first == NULL) {
+      *lo = *hi = 0;
+      return;
+   }
+   while (first->left != NULL) first = first->left;
+   while (last->right != NULL) last = last->right;
+   *lo = first->start;
+   *hi = run_end(last);
+}
+
+static long
+Rle_Count (Tape *t, long lo, long hi, char c)
+{
+   struct rle_tape *tape = (struct rle_tape *)t;
+
+   // Add up the part of each run inside [lo, hi) holding c, and the
+   // blank gaps between them.
+   long count = 0;
+   long pos = lo;
+   struct run *run = find(tape, lo);
+   if (run == NULL)
+      run = first_run(tape);
+   for (; run != NULL && run->start < hi; run = run->next) {
+      long from = run->start > pos ? run->start : pos;
+      long to = run_end(run) < hi ? run_end(run) : hi;
+      if (from >= to) continue;
+      if (c == BLANK) count += from - pos;
+      if (run->sym == c) count += to - from;
+      pos = to;
+   }
+   if (c == BLANK) count += hi - pos;
+   return count;
+}
+
+static int
+Rle_Export (Tape *t, long lo, long hi, int fd)
+{
+   struct rle_tape *tape = (struct rle_tape *)t;
+
+   // Every run is written out of a buffer full of its symbol. The buffers
+   // are made as they're needed, and shared by every run of that symbol.
+   char *fills[256] = { NULL };
+   struct iovec iov[IOV_MAX];
+   int count = 0;
+   int result = 0;
+
+   struct run *run = find(tape, lo);
+   if (run == NULL)
+      run = first_run(tape);
+   long pos = lo;
+   while (pos < hi && result == 0) {
+
+      // Work out the symbol and length of the next stretch of tape.
+      char sym = BLANK;
+      long to = hi;
+      while (run != NULL && run_end(run) <= pos) run = run->next;
+      if (run != NULL && run->start <= pos) {
+         sym = run->sym;
+         to = run_end(run) < hi ? run_end(run) : hi;
+      }
+      else if (run != NULL && run->start < hi) {
+         to = run->start;
+      }
+
+      // Point at its fill buffer as many times as it takes.
+      unsigned char idx = (unsigned char)sym;
+      if (fills[idx] == NULL) {
+         fills[idx] = malloc(FILL_SIZE);
+         memset(fills[idx], sym, FILL_SIZE);
+      }
+      for (; pos < to; pos += FILL_SIZE) {
+         iov[count].iov_base = fills[idx];
+         iov[count].iov_len = to - pos < FILL_SIZE ? to - pos : FILL_SIZE;
+         if (++count == IOV_MAX) {
+            result = Tape_WriteAll(fd, iov, count);
+            count = 0;
+            if (result != 0) break;
+         }
+      }
+      pos = to;
+   }
+   if (result == 0)
+      result = Tape_WriteAll(fd, iov, count);
+
+   int i;
+   for (i=0; i < 256; i++) {
+      free(fills[i]);
+   }
+   return result;
+}
+
+static Tape *
+Rle_Fork (Tape *t)
+{
+   struct rle_tape *tape = (struct rle_tape *)t;
+   struct rle_tape *fork = (struct rle_tape *)Tape_MakeRle();
+
+   // Copy every run across in order.
+   struct run *run = first_run(tape);
+   struct run *last = NULL;
+   for (; run != NULL; run = run->next) {
+      last = add_run(fork, last, run->start, run->len, run->sym);
+   }
+   fork->cursor = last;
+   return &fork->base;
+}
+
+static void
+Rle_Del (Tape *t)
+{
+   struct rle_tape *tape = (struct rle_tape *)t;
+   treap_free(tape->root);
+   free(tape);
+}
@@ -0,0 +1,107 @@
+
+// Header files.
+// ======================================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+
+
+// Definitions.
+// ======================================================================
+
+#define BLOCK_SIZE 16384
+#define ALIGNMENT (sizeof (max_align_t))
+
+   /**
+      The arena is a list of blocks, newest first. Allocations are bumped
+      off the front block; one too big for a normal block gets a block
+      of its own.
+   **/
+struct block {
+   struct block *next;
+   size_t size;
+   size_t used;
+   max_align_t data[];
+};
+
+struct arena {
+   struct block *blocks;
+};
+
+
+
+// Internal functions.
+// ======================================================================
+
+static inline size_t round_up (size_t size)
+{
+   return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+static struct block *add_block (struct arena *arena, size_t size)
+{
+   struct block *block = malloc(sizeof(struct block) + size);
+   block->size = size;
+   block->used = 0;
+   block->next = arena->blocks;
+   arena->blocks = block;
+   return block;
+}
+
+
+
+// Public functions.
+// ======================================================================
+
+Arena *Arena_Make (void)
+{
+   struct arena *arena = malloc(sizeof(struct arena));
+   arena->blocks = NULL;
+   return arena;
+}
+
+void Arena_Free (Arena *arena)
+{
+   struct block *block = arena->blocks;
+   while (block != NULL) {
+      struct block *next = block->next;
+      free(block);
+      block = next;
+   }
+   free(arena);
+}
+
+void *Arena_Alloc (Arena *arena, size_t size)
+{
+   size = round_up(size == 0 ? 1 : size);
+   struct block *block = arena->blocks;
+
+   // Big allocations get their own block, behind the current one so that
+   // it can still be used.
+   if (size > BLOCK_SIZE / 4) {
+      struct block *big = add_block(arena, size);
+      if (block != NULL) {
+         arena->blocks = block;
+         big->next = block->next;
+         block->next = big;
+      }
+      big->used = size;
+      return big->data;
+   }
+
+   if (block == NULL || block->size - block->used < size)
+      block = add_block(arena, BLOCK_SIZE);
+   void *mem = (char *)block->data + block->used;
+   block->used += size;
+   return mem;
+}
+
+void *Arena_Calloc (Arena *arena, size_t count, size_t size)
+{
+   void *mem = Arena_Alloc(arena, count * size);
+   memset(mem, 0, count * size);
+   return mem;
+}
@@ -0,0 +1,38 @@
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct arena Arena;
+
+   /**
+      An arena hands out memory from large blocks, and frees all of it at
+      once with Arena_Free. Nothing allocated from an arena can be freed on
+      its own. Use one for a group of objects which all die together.
+    **/
+Arena *Arena_Make (void);
+
+   /**
+      Free the arena and everything allocated from it.
+         arena : arena to free. **/
+void Arena_Free (Arena *arena);
+
+   /**
+      Allocate memory from the arena. The memory is suitably aligned
+      for any type, as with malloc.
+         arena : arena to allocate from.
+         size : number of bytes needed. **/
+void *Arena_Alloc (Arena *arena,
+                   size_t size);
+
+   /**
+      Allocate zeroed memory for an array from the arena, as with calloc.
+         arena : arena to allocate from.
+         count : number of elements.
+         size : size of each element. **/
+void *Arena_Calloc (Arena *arena,
+                    size_t count,
+                    size_t size);
+
+#endif
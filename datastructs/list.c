@@ -3,11 +3,13 @@
 // ======================================================================
 
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "list.h"
+#include "simd.h"
 
 
 
@@ -17,6 +19,13 @@
 typedef int (*CmpFunc)(void *, void*);
 typedef void (*FreeFunc)(void *);
 
+#define LIST_INLINE 32
+
+   /**
+      The first LIST_INLINE bytes of elements are kept in the list itself,
+      so small lists don't need a second allocation. arr points at small
+      until the list outgrows it.
+   **/
 struct list {
    int len;
    int capacity;
@@ -24,6 +33,10 @@ struct list {
    void *arr;
    CmpFunc cmp;
    FreeFunc free_item;
+   union {
+      max_align_t align;
+      char bytes[LIST_INLINE];
+   } small;
 };
 
 static inline int item_eq (struct list *list, void *item1, void *item2);
@@ -49,6 +62,11 @@ static inline void item_free (struct list *list, void *item)
       (*(list->free_item))(item);
 }
 
+static inline int is_inline (struct list *list)
+{
+   return list->arr == list->small.bytes;
+}
+
 static inline int should_resize (struct list *list)
 {
    return list->capacity == list->len;
@@ -59,7 +77,7 @@ static void resize (struct list *list)
 
    // Allocate memory for new array. Use char * so that pointer
    // arithmetic moves by one byte each time.
-   int new_capacity = list->capacity * 2;
+   int new_capacity = list->capacity > 0 ? list->capacity * 2 : 1;
    char *new_arr = calloc(list->szitem, new_capacity);
    char *old_arr = list->arr;
    int szitem = list->szitem;
@@ -72,7 +90,8 @@ static void resize (struct list *list)
    }
    
    // Free old table, update the struct.
-   free(old_arr);
+   if (!is_inline(list))
+      free(old_arr);
    list->capacity = new_capacity;
    list->arr = (void *)new_arr;
    
@@ -102,8 +121,18 @@ List * List_Make (int initial_capacity,
                  FreeFunc free)
 {
    struct list *list = malloc(sizeof (struct list));
-   list->arr = calloc(elem_size, initial_capacity);
-   list->capacity = initial_capacity;
+
+   // Start inline if the elements fit, heap allocate if they don't.
+   int fits = elem_size > 0 ? LIST_INLINE / elem_size : 0;
+   if (initial_capacity <= fits) {
+      memset(list->small.bytes, 0, LIST_INLINE);
+      list->arr = list->small.bytes;
+      list->capacity = fits;
+   }
+   else {
+      list->arr = calloc(elem_size, initial_capacity);
+      list->capacity = initial_capacity;
+   }
    list->szitem = elem_size;
    list->cmp = cmp;
    list->len = 0;
@@ -122,8 +151,9 @@ void List_Free (List *list)
       memset(item, 0, list->szitem);
    }
 
-   free(list->arr);
-   list->arr = NULL;
+   if (!is_inline(list))
+      free(list->arr);
+   free(list);
 }
 
 int List_Size (List *list)
@@ -177,7 +207,14 @@ int List_IndexOf (List *list,
    // Some preliminary checks.
    if (item == NULL)
       return -1;
-      
+
+   // Small plain elements can be compared many at a time.
+   int sz = list->szitem;
+   if (!list->cmp && (sz == 1 || sz == 2 || sz == 4 || sz == 8)) {
+      long i = Simd_FindElem(list->arr, list->len, item, sz);
+      return i == list->len ? -1 : i;
+   }
+
    // Check each element in array.
    int i;
    for (i=0; i < list->len; i++) {
@@ -217,6 +254,16 @@ void *List_Get (List *list,
 
 }
 
+void *List_At (List *list,
+               int index)
+{
+   if (index < 0)
+      out_of_bounds();
+   if (index >= list->len)
+      return NULL;
+   return offset(list, index);
+}
+
 int List_Del (List *list,
                int index)
 {
@@ -229,7 +276,7 @@ int List_Del (List *list,
    
    // Get offset, free stuff at that position.
    void *curr = offset(list, index);
-   item_free(list, offset);
+   item_free(list, curr);
    
    // Move everything down.
    int i;
@@ -240,7 +287,7 @@ int List_Del (List *list,
    }
 
    // Zero out stuff at last position.
-   curr = offset(list, i);
+   curr = offset(list, list->len - 1);
    memset(curr, 0, list->szitem);
    
    // Update list.
@@ -6,7 +6,9 @@ typedef struct list List;
 
    /**
       Construct a new list. Returns a pointer to the list.
-      It must be freed using ListFree.
+      It must be freed using ListFree. The first few elements
+      are stored in the list itself; it only allocates an array
+      once it grows beyond them.
          initial_capacity : starting size of the list.
          elem_size : size of the elements (in bytes) that will
             be in the list.
@@ -53,7 +55,9 @@ void List_Insert (List *list,
       Check if the item is in the list and return the first index
       where it is located. Your input is checked against each
       item in the list using the comparator function you passed
-      in when constructing the list; otherwise it uses memcmp.
+      in when constructing the list; otherwise it uses memcmp,
+      comparing several elements at a time when they are 1, 2, 4
+      or 8 bytes big.
          list : list to check through.
          item : item you're searching for. **/
 int List_IndexOf (List *list,
@@ -80,6 +84,16 @@ int List_Contains (List *list,
 void *List_Get (List *list,
                 int index);
                 
+   /**
+      Get a pointer to the item in the list at the specified index,
+      without copying it. The pointer is only good until the list
+      is next changed. Returns a NULL pointer if there is no item at
+      that index. Aborts if the index is out of bounds.
+         list : list to check.
+         index : location to get the item from. **/
+void *List_At (List *list,
+               int index);
+
    /**
       Delete the item at the specified index. Does nothing if
       there is no item at that index. Aborts if the index is out
@@ -5,7 +5,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "list.h"
 #include "map.h"
 
 
@@ -22,37 +21,53 @@ typedef unsigned int (*HashFunc)(void *);
 // Definitions.
 // ======================================================================
 
-struct bucket {
-   List *keys;
-   List *vals;
-};
-
+   /**
+      The map is an open-addressing hash table using Robin Hood hashing.
+      Keys and values are stored inline, one pair per slot, and the hash of
+      each slot's key is kept alongside it in a separate array. A stored
+      hash of 0 marks an empty slot (real hashes always have the top bit
+      set). A key lives at the first free slot at or after its home slot;
+      when inserting, a key which is further from home than the one in the
+      slot takes the slot and the displaced key moves on. This keeps probe
+      sequences short, lets lookups stop early, and lets deletion shift
+      later keys back instead of leaving tombstones.
+         capacity : number of slots. Always a power of two.
+         items : number of key-value pairs in the map.
+         szslot : size of a slot; the value starts szkeyslot bytes in.
+         hashes : the stored hash of each slot.
+         slots : the key-value pairs.
+   **/
 struct map {
    int capacity;
-   int items; // number of things in the map.
+   int items;
    int szkey;
    int szval;
+   int szkeyslot;
+   int szslot;
    HashFunc hash;
    FreeFunc keyfree;
    FreeFunc valfree;
    CmpFunc keycmp;
    CmpFunc valcmp;
-   struct bucket *table; // array of list ptrs.
+   unsigned int *hashes;
+   char *slots;
 };
 
-// Block of all zeroes.
-// Used to see if a bucket has been initialised at an index.
-static const char emptyblock[sizeof (struct bucket)];
+#define MIN_CAPACITY 8
+#define FULL_BIT 0x80000000u
+#define ALIGN(n) (((n) + 7) & ~7)
 
 // Internal functions.
 static unsigned int djb2 (struct map *map, void *key);
 static unsigned int hash (struct map *map, void *key);
-static int should_resize (struct map *map);
-static void rebuild (struct map *map);
-static inline void init_bucket (struct map *map, struct bucket *table, unsigned int index);
-static inline void free_bucket (struct bucket bucket);
-static inline int bucket_exists (struct bucket *table, unsigned int index);
-static int Table_Put (Map *map, struct bucket *table, void *key, void *val, unsigned int index);
+static inline void *slot_key (struct map *map, int index);
+static inline void *slot_val (struct map *map, int index);
+static inline int distance (struct map *map, int index);
+static inline int keys_eq (struct map *map, void *key1, void *key2);
+static int find (struct map *map, void *key, unsigned int h);
+static void insert (struct map *map, void *key, void *val, unsigned int h);
+static void resize (struct map *map, int capacity);
+static int fit_capacity (int items);
 
 
 
@@ -64,141 +79,154 @@ static unsigned int djb2 (struct map *map, void *key)
    unsigned int hash = 5381;
    char *ptr = (char *)key;
    int i;
-   
+
    for (i=0; i < map->szkey; i++) {
       char c = *(ptr + i);
       hash = ((hash << 5) + hash) + c;
    }
-   
+
    return hash;
 }
 
    /**
-      Run an item through the hash function of a map. This is NOT guaranteed
-      to return a valid index to the map's table (you should mod the length of
-      the table), but it will return a non-negative value.
+      Run an item through the hash function of a map, and scramble the
+      result so that weak hash functions (e.g. the identity) still spread
+      over the table. The result always has FULL_BIT set.
          map : map you're performing the hash for.
          key : thing to be hashed.
     **/
 static unsigned int hash (struct map *map, void *key)
 {
-   if (map->hash) return map->hash(key);
-   else return djb2(map, key);
+   unsigned int h = map->hash ? map->hash(key) : djb2(map, key);
+   h ^= h >> 16;
+   h *= 0x45D9F3Bu;
+   h ^= h >> 16;
+   return h | FULL_BIT;
 }
 
-   /**
-      Whether the table should be rebuilt. This is based on the ratio of
-      items in the table to the capacity of the table.
-         map : map to check.
-    **/
-static int should_resize (struct map *map)
+static inline void *slot_key (struct map *map, int index)
 {
-   float density = (float)map->items / (float)map->capacity;
-   return density > 0.75;
+   return map->slots + (size_t)index * map->szslot;
 }
 
-   /**
-      Initialise a new bucket in the map's table at the given index. This
-      involves allocating memory for the two lists that the bucket refers to.
-         map : map to initialise bucket for.
-         index : index where the bucket should be created.
-    **/
-static inline void init_bucket (struct map *map, struct bucket *table, unsigned int index)
+static inline void *slot_val (struct map *map, int index)
 {
-   table[index].keys = List_Make(10, map->szkey, map->keycmp, map->keyfree);
-   table[index].vals = List_Make(10, map->szval, map->valcmp, map->valfree);
+   return map->slots + (size_t)index * map->szslot + map->szkeyslot;
 }
 
    /**
-      Free memory referred to by a given bucket.
-         bucket : bucket whose members should be freed.
+      How far the key in a full slot is from its home slot.
     **/
-static inline void free_bucket (struct bucket bucket)
+static inline int distance (struct map *map, int index)
 {
-   List_Free(bucket.keys);
-   List_Free(bucket.vals);
+   int home = map->hashes[index] & (map->capacity - 1);
+   return (index - home) & (map->capacity - 1);
+}
+
+static inline int keys_eq (struct map *map, void *key1, void *key2)
+{
+   if (map->keycmp) return !map->keycmp(key1, key2);
+   return !memcmp(key1, key2, map->szkey);
 }
 
    /**
-      Check if a bucket at a specific index has been initialised.
-         map : map to check.
-         index : index of bucket to check.
+      Return the slot holding the key, or -1 if it isn't in the map.
+         map : map to look in.
+         key : key to look for.
+         h : the key's hash.
     **/
-static inline int bucket_exists (struct bucket *table, unsigned int index)
+static int find (struct map *map, void *key, unsigned int h)
 {
-   return memcmp(emptyblock, table + index, sizeof (struct bucket));
+   int mask = map->capacity - 1;
+   int i = h & mask;
+   int dist = 0;
+   while (map->hashes[i] != 0) {
+
+      // Every key from here on is closer to home than this one would be,
+      // so it can't be further along.
+      if (distance(map, i) < dist)
+         return -1;
+      if (map->hashes[i] == h && keys_eq(map, slot_key(map, i), key))
+         return i;
+      i = (i + 1) & mask;
+      dist++;
+   }
+   return -1;
 }
 
    /**
-      Insert the key-value pair into the table of the map at the given index.
-      The table you're inserting into might not be the same as the table the
-      map currently references.
-      
-      Returns non-zero if a new key was added to the table (so it returns 0
-      if you overwrite a key).
+      Insert a key-value pair which isn't in the map yet. There must be a
+      free slot.
     **/
-static int Table_Put (Map *map, struct bucket *table, void *key, void *val, unsigned int index)
+static void insert (struct map *map, void *key, void *val, unsigned int h)
 {
-   if (!bucket_exists(table, index))
-      init_bucket(map, table, index);
-   struct bucket *buck = table + index;
-
-   // Check if that key is already here.
-   int key_index = List_IndexOf(buck->keys, key);
-   
-   // Append (key, val) if it does not exist.
-   if (key_index == -1) {
-      List_Append(buck->keys, key);
-      List_Append(buck->vals, val);
-      return 1;   
-      map->items += 1;
-   }
 
-   // Overwrite (key, val) if it already exists.
-   else {
-      List_Insert(buck->keys, key, key_index);
-      List_Insert(buck->vals, val, key_index);   
-      return 0;   
+   // The pair being placed lives in a buffer, as it gets swapped with
+   // pairs already in the table.
+   char pair[map->szslot];
+   char swap[map->szslot];
+   memcpy(pair, key, map->szkey);
+   memcpy(pair + map->szkeyslot, val, map->szval);
+
+   int mask = map->capacity - 1;
+   int i = h & mask;
+   int dist = 0;
+   while (map->hashes[i] != 0) {
+      int other = distance(map, i);
+      if (other < dist) {
+         unsigned int other_h = map->hashes[i];
+         map->hashes[i] = h;
+         h = other_h;
+         memcpy(swap, slot_key(map, i), map->szslot);
+         memcpy(slot_key(map, i), pair, map->szslot);
+         memcpy(pair, swap, map->szslot);
+         dist = other;
+      }
+      i = (i + 1) & mask;
+      dist++;
    }
+   map->hashes[i] = h;
+   memcpy(slot_key(map, i), pair, map->szslot);
+   map->items++;
+
 }
 
    /**
-      Rebuild the map's table. This extends the capacity of the table and copy
-      everything across by rehashing 
+      Move everything into a table with the given number of slots, which
+      must be a power of two big enough to hold everything.
     **/
-static void rebuild (struct map *map)
+static void resize (struct map *map, int capacity)
 {
+   unsigned int *old_hashes = map->hashes;
+   char *old_slots = map->slots;
+   int old_capacity = map->capacity;
 
-   // Allocate memory for new table.
-   int new_capacity = map->capacity * 2;
-   struct bucket *new_table = calloc(sizeof (struct bucket), new_capacity);
-   struct bucket *old_table = map->table;
+   map->capacity = capacity;
+   map->items = 0;
+   map->hashes = calloc(capacity, sizeof (unsigned int));
+   map->slots = malloc((size_t)capacity * map->szslot);
 
-   // Look in every bucket, rehash everything into the new table.
-   // Note: the buckets in the new table could be different.
    int i;
-   for (i=0; i < map->capacity; i++) {
-
-      // Nothing to rehash at this position.
-      if (!bucket_exists(old_table, i)) continue;
-
-      // Look at the key-value pairs in the bucket. Rehash into new table.
-      struct bucket bucket = map->table[i];
-      int items_to_hash = List_Size(bucket.keys);
-      int j;
-      for (j=0; j < items_to_hash; j++) {
-         void *key = List_Get(bucket.keys, j);
-         unsigned int new_index = hash(map, key) % new_capacity;
-         void *val = List_Get(bucket.vals, j);
-         Table_Put(map, new_table, key, val, new_index);
-      }
-
+   for (i=0; i < old_capacity; i++) {
+      if (old_hashes[i] == 0) continue;
+      char *pair = old_slots + (size_t)i * map->szslot;
+      insert(map, pair, pair + map->szkeyslot, old_hashes[i]);
    }
+   free(old_hashes);
+   free(old_slots);
+}
+
 
-   // Update map.
-   map->table = new_table;
-   map->capacity = new_capacity;
-   free(old_table);
+   /**
+      The smallest capacity that holds the given number of items without
+      going over 7/8 full.
+    **/
+static int fit_capacity (int items)
+{
+   int capacity = MIN_CAPACITY;
+   while ((long)items * 8 > (long)capacity * 7)
+      capacity *= 2;
+   return capacity;
 }
 
 
@@ -227,19 +255,23 @@ Map *Map_Make (int init_capacity,
                unsigned int (*hash)(void *),
                void (*freeKeys)(void *),
                int (*cmpKeys)(void *, void *),
-               void (*freeVals)(void *), 
+               void (*freeVals)(void *),
                int (*cmpVals)(void *, void *))
 {
    struct map *map = malloc(sizeof (struct map));
-   map->capacity = init_capacity;
+   map->capacity = fit_capacity(init_capacity);
+   map->items = 0;
    map->szkey = szKey;
    map->szval = szVal;
+   map->szkeyslot = ALIGN(szKey);
+   map->szslot = map->szkeyslot + ALIGN(szVal);
    map->hash = hash;
    map->keyfree = freeKeys;
    map->valfree = freeVals;
    map->valcmp = cmpVals;
    map->keycmp = cmpKeys;
-   map->table = calloc(init_capacity, sizeof (struct bucket));
+   map->hashes = calloc(map->capacity, sizeof (unsigned int));
+   map->slots = malloc((size_t)map->capacity * map->szslot);
    return map;
 }
 
@@ -252,12 +284,12 @@ void Map_Free (Map *map)
 {
    int i;
    for (i=0 ; i < map->capacity; i++) {
-      if (!bucket_exists(map->table, i)) continue;
-      struct bucket buck = map->table[i];
-      List_Free(buck.keys);
-      List_Free(buck.vals);
+      if (map->hashes[i] == 0) continue;
+      if (map->keyfree) map->keyfree(slot_key(map, i));
+      if (map->valfree) map->valfree(slot_val(map, i));
    }
-   free(map->table);
+   free(map->hashes);
+   free(map->slots);
    free(map);
 }
 
@@ -269,6 +301,14 @@ int Map_Size (Map *map){
    return map->items;
 }
 
+   /**
+      Return the number of slots in the map's table.
+         map : map to check.
+    **/
+int Map_Capacity (Map *map){
+   return map->capacity;
+}
+
    /**
       Check whether the given key is in the map.
          map : map to check.
@@ -277,15 +317,7 @@ int Map_Size (Map *map){
 int Map_Contains (Map *map,
                   void *key)
 {
-   // Get the appropriate bucket.
-   unsigned int hash_index = hash(map, key) % map->capacity;
-   struct bucket buck = map->table[hash_index];
-
-   // If nothing in the bucket, map does not contain key.
-   if (buck.keys == NULL) return 0;
-
-   // Otherwise look through the bucket's keys.
-   return List_Contains(buck.keys, key);
+   return find(map, key, hash(map, key)) != -1;
 }
 
    /**
@@ -296,18 +328,9 @@ int Map_Contains (Map *map,
 void *Map_Get (Map *map,
                   void *key)
 {
-
-   // Find appropriate bucket.
-   unsigned int hash_index = hash(map, key) % map->capacity;
-   if (!bucket_exists(map->table, hash_index))
-      return NULL;
-
-   // Check list of keys in the bucket.
-   struct bucket buck = map->table[hash_index];
-   int key_index = List_IndexOf(buck.keys, key);
-   if (key_index == -1) return NULL;
-   return List_Get(buck.vals, key_index);
-
+   int index = find(map, key, hash(map, key));
+   if (index == -1) return NULL;
+   return slot_val(map, index);
 }
 
    /**
@@ -319,17 +342,19 @@ void *Map_Get (Map *map,
 void Map_Put (Map *map, void *key, void *val)
 {
 
-   // Check if it's time to resize.
-   if (should_resize(map))
-      rebuild(map);
-      
-   // Find bucket where (key, val) should go.
-   unsigned int hash_index = hash(map, key) % map->capacity;
+   // Overwrite the value if the key is already here.
+   unsigned int h = hash(map, key);
+   int index = find(map, key, h);
+   if (index != -1) {
+      if (map->valfree) map->valfree(slot_val(map, index));
+      memcpy(slot_val(map, index), val, map->szval);
+      return;
+   }
 
-   // Put (key, val) into table.
-   // Only update item count if a new key was inserted.
-   if (Table_Put(map, map->table, key, val, hash_index))
-      map->items += 1;
+   // Grow once the table is 7/8 full.
+   if ((map->items + 1) * 8 > map->capacity * 7)
+      resize(map, map->capacity * 2);
+   insert(map, key, val, h);
 
 }
 
@@ -343,17 +368,99 @@ int Map_Del (Map *map,
              void *key)
 {
 
-   // Find bucket where (key, val) should go.
-   unsigned int hash_index = hash(map, key) & map->capacity;
-   if (!bucket_exists(map->table, hash_index))
+   // Find the pair and free it.
+   int index = find(map, key, hash(map, key));
+   if (index == -1)
       return 0;
-   struct bucket *buck = map->table + hash_index;  
+   if (map->keyfree) map->keyfree(slot_key(map, index));
+   if (map->valfree) map->valfree(slot_val(map, index));
+
+   // Shift the following keys back a slot, until one is already home.
+   int mask = map->capacity - 1;
+   int next = (index + 1) & mask;
+   while (map->hashes[next] != 0 && distance(map, next) > 0) {
+      map->hashes[index] = map->hashes[next];
+      memcpy(slot_key(map, index), slot_key(map, next), map->szslot);
+      index = next;
+      next = (next + 1) & mask;
+   }
+   map->hashes[index] = 0;
+   map->items--;
 
-   // Check if key is in this bucket.
-   int in_map = List_Contains(buck->keys, key);
-   if (in_map) map->items -= 1;
-   return in_map;
+   // Give memory back once the table is mostly empty.
+   if (map->items * 8 < map->capacity && map->capacity > MIN_CAPACITY)
+      resize(map, map->capacity / 2);
+   return 1;
+
+}
+
+   /**
+      Make room for the given number of pairs in total, so that putting
+      that many in won't need the table to grow.
+         map : map to grow.
+         items : number of pairs the map should be able to hold.
+   **/
+void Map_Reserve (Map *map,
+                  int items)
+{
+   int capacity = fit_capacity(items);
+   if (capacity > map->capacity)
+      resize(map, capacity);
+}
 
+   /**
+      Shrink the table to the smallest size that holds what is in it.
+         map : map to shrink.
+   **/
+void Map_Shrink (Map *map)
+{
+   int capacity = fit_capacity(map->items);
+   if (capacity < map->capacity)
+      resize(map, capacity);
 }
 
+   /**
+      Put count pairs into the map at once. The keys and values are
+      packed arrays of keys and values, as for Map_Put.
+         map : map to put the pairs into.
+         keys : array of count keys.
+         vals : array of count values.
+         count : number of pairs.
+   **/
+void Map_PutAll (Map *map,
+                 void *keys,
+                 void *vals,
+                 int count)
+{
+   Map_Reserve(map, map->items + count);
+   int i;
+   for (i=0; i < count; i++) {
+      Map_Put(map, (char *)keys + (size_t)i * map->szkey,
+                   (char *)vals + (size_t)i * map->szval);
+   }
+}
 
+   /**
+      Step through the pairs in the map, in no particular order.
+         map : map to iterate over.
+         cursor : where the iteration is up to. Set it to 0 to start.
+         key, val : set to point at the next key and value, inside the
+            map. Either can be NULL if you don't need it.
+      Returns 0 when there are no pairs left.
+   **/
+int Map_Next (Map *map,
+              int *cursor,
+              void **key,
+              void **val)
+{
+   int i;
+   for (i = *cursor; i < map->capacity; i++) {
+      if (map->hashes[i] == 0) continue;
+      if (key) *key = slot_key(map, i);
+      if (val) *val = slot_val(map, i);
+      *cursor = i + 1;
+      return 1;
+   }
+   *cursor = map->capacity;
+   return 0;
+}
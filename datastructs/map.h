@@ -3,7 +3,8 @@
 #define MAP_H
 
    /**
-      A generic Map with copy-by-value semantics.
+      A generic Map with copy-by-value semantics. Keys and values are
+      copied into the map's own table.
     **/
 typedef struct map Map;
 
@@ -44,6 +45,13 @@ void Map_Free (Map *map);
     **/
 int Map_Size (Map *map);
 
+   /**
+      Return the number of slots in the map's table, which is what
+      Map_Reserve grows and Map_Shrink shrinks.
+         map : map to check.
+    **/
+int Map_Capacity (Map *map);
+
    /**
       Check whether the given key is in the map.
          map : map to check.
@@ -53,7 +61,9 @@ int Map_Contains (Map *map,
                   void *key);
 
    /**
-      Get the value associated with the specified key.
+      Get the value associated with the specified key. Returns a pointer
+      to the value inside the map (not a copy), or NULL if the key isn't
+      there. The pointer is valid until the map is next modified.
          map : map to check.
          key : key to check for.
     **/
@@ -69,12 +79,59 @@ void *Map_Get (Map *map,
 void Map_Put (Map *map, void *key, void *val);
 
    /**
-      Delete the pair associated with the gievn key.
-      Returns non-negative value if something was deleted.
+      Delete the pair associated with the given key, freeing it.
+      Returns non-zero if something was deleted.
          map : map the key-value pair is in.
          key : the key indexing the pair to be deleted.
    **/
 int Map_Del (Map *map,
              void *key);
 
+   /**
+      Make room for the given number of pairs in total, so that putting
+      that many in won't need the table to grow.
+         map : map to grow.
+         items : number of pairs the map should be able to hold.
+   **/
+void Map_Reserve (Map *map,
+                  int items);
+
+   /**
+      Shrink the table to the smallest size that holds what is in it.
+      Map_Del also shrinks the table once it is mostly empty.
+         map : map to shrink.
+   **/
+void Map_Shrink (Map *map);
+
+   /**
+      Put count pairs into the map at once, growing the table just once.
+         map : map to put the pairs into.
+         keys : packed array of count keys.
+         vals : packed array of count values.
+         count : number of pairs.
+   **/
+void Map_PutAll (Map *map,
+                 void *keys,
+                 void *vals,
+                 int count);
+
+   /**
+      Step through the pairs in the map, in no particular order. Don't
+      modify the map while iterating over it.
+
+         int cursor = 0;
+         void *key, *val;
+         while (Map_Next(map, &cursor, &key, &val)) { ... }
+
+         map : map to iterate over.
+         cursor : where the iteration is up to. Set it to 0 to start.
+         key, val : set to point at the next key and value, inside the
+            map. Either can be NULL if you don't need it.
+      Returns 0 when there are no pairs left.
+   **/
+int Map_Next (Map *map,
+              int *cursor,
+              void **key,
+              void **val);
+
 #endif
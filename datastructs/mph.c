@@ -0,0 +1,195 @@
+
+// Header files.
+// ======================================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mph.h"
+
+
+
+// Definitions.
+// ======================================================================
+
+   /**
+      The keys are split into buckets of about BUCKET_SIZE keys by one hash.
+      Each bucket gets a displacement, chosen so that the second hash of
+      each of its keys, perturbed by the displacement, lands on a free index.
+      Buckets are placed biggest first, while there is the most room.
+         n : number of keys.
+         buckets : number of buckets.
+         seed : seed for both hashes; changed if building gets stuck.
+         disp : the displacement of each bucket.
+   **/
+struct mph {
+   int n;
+   int buckets;
+   unsigned int seed;
+   unsigned int *disp;
+};
+
+#define BUCKET_SIZE 4
+#define MAX_DISP (1 << 20)
+#define MAX_SEEDS 16
+
+   /**
+      The murmur3 finaliser; a good 32-bit mix.
+   **/
+static inline unsigned int mix (unsigned int h)
+{
+   h ^= h >> 16;
+   h *= 0x85EBCA6Bu;
+   h ^= h >> 13;
+   h *= 0xC2B2AE35u;
+   h ^= h >> 16;
+   return h;
+}
+
+static inline int bucket_of (struct mph *mph, unsigned int hash)
+{
+   return mix(hash ^ mph->seed) % mph->buckets;
+}
+
+static inline int index_of (struct mph *mph, unsigned int hash, unsigned int disp)
+{
+   return mix(hash + mph->seed * 0x9E3779B9u + disp * 0x61C88647u) % mph->n;
+}
+
+static int cmp_uint (const void *a, const void *b)
+{
+   unsigned int x = *(unsigned int *)a, y = *(unsigned int *)b;
+   return x < y ? -1 : x > y;
+}
+
+   /**
+      Try to place every key with the current seed. Returns 0 if some bucket
+      can't be placed.
+         order : buffer for the bucket order.
+         taken : buffer for which indexes are used.
+   **/
+static int place (struct mph *mph, unsigned int *hashes, int *order, char *taken)
+{
+   int n = mph->n, b;
+
+   // Sort the keys by bucket, biggest buckets first.
+   int *size = calloc(mph->buckets + 1, sizeof(int));
+   int *start = malloc((mph->buckets + 1) * sizeof(int));
+   int i;
+   for (i=0; i < n; i++) {
+      size[bucket_of(mph, hashes[i])]++;
+   }
+   int *by_size = malloc(mph->buckets * sizeof(int));
+   int *count = calloc(n + 1, sizeof(int));
+   for (b=0; b < mph->buckets; b++) {
+      count[size[b]]++;
+   }
+   int pos = 0, s;
+   for (s = n; s >= 0; s--) {
+      int c = count[s];
+      count[s] = pos;
+      pos += c;
+   }
+   for (b=0; b < mph->buckets; b++) {
+      by_size[count[size[b]]++] = b;
+   }
+   start[0] = 0;
+   for (b=0; b < mph->buckets; b++) {
+      start[b + 1] = start[b] + size[b];
+   }
+   memset(size, 0, mph->buckets * sizeof(int));
+   for (i=0; i < n; i++) {
+      b = bucket_of(mph, hashes[i]);
+      order[start[b] + size[b]++] = i;
+   }
+
+   // Displace each bucket in turn.
+   memset(taken, 0, (unsigned int)n);
+   int ok = 1;
+   int k;
+   for (k=0; k < mph->buckets && ok; k++) {
+      b = by_size[k];
+      if (size[b] == 0) break;
+      int *keys = order + start[b];
+      unsigned int d;
+      for (d=0; d < MAX_DISP; d++) {
+         int j;
+         for (j=0; j < size[b]; j++) {
+            int idx = index_of(mph, hashes[keys[j]], d);
+            if (taken[idx]) break;
+            taken[idx] = 1;
+         }
+         if (j == size[b]) break;
+
+         // Undo this attempt.
+         while (j-- > 0) {
+            taken[index_of(mph, hashes[keys[j]], d)] = 0;
+         }
+      }
+      if (d == MAX_DISP) ok = 0;
+      mph->disp[b] = d;
+   }
+
+   free(size);
+   free(start);
+   free(by_size);
+   free(count);
+   return ok;
+}
+
+
+
+// Public functions.
+// ======================================================================
+
+Mph *Mph_Build (unsigned int *hashes, int n)
+{
+
+   // Two equal hashes can never be separated.
+   unsigned int *sorted = malloc((n + 1) * sizeof(unsigned int));
+   memcpy(sorted, hashes, n * sizeof(unsigned int));
+   qsort(sorted, n, sizeof(unsigned int), cmp_uint);
+   int i;
+   for (i=1; i < n; i++) {
+      if (sorted[i] == sorted[i - 1]) {
+         free(sorted);
+         return NULL;
+      }
+   }
+   free(sorted);
+
+   struct mph *mph = malloc(sizeof(struct mph));
+   mph->n = n;
+   mph->buckets = n / BUCKET_SIZE + 1;
+   mph->disp = calloc(mph->buckets, sizeof(unsigned int));
+   if (n == 0)
+      return mph;
+
+   // Keep trying seeds until everything fits.
+   int *order = malloc(n * sizeof(int));
+   char *taken = malloc(n);
+   int ok = 0;
+   for (mph->seed = 0; mph->seed < MAX_SEEDS && !ok; mph->seed++) {
+      ok = place(mph, hashes, order, taken);
+      if (ok) break;
+   }
+   free(order);
+   free(taken);
+   if (!ok) {
+      Mph_Free(mph);
+      return NULL;
+   }
+   return mph;
+
+}
+
+void Mph_Free (Mph *mph)
+{
+   free(mph->disp);
+   free(mph);
+}
+
+int Mph_Index (Mph *mph, unsigned int hash)
+{
+   return index_of(mph, hash, mph->disp[bucket_of(mph, hash)]);
+}
@@ -0,0 +1,36 @@
+
+#ifndef MPH_H
+#define MPH_H
+
+typedef struct mph Mph;
+
+   /**
+      A minimal perfect hash over a fixed set of n keys: it maps each of
+      them to a different index in [0, n), with no collisions, so a lookup
+      is a single probe. It is built with the CHD (compress, hash and
+      displace) algorithm. Keys are given by their hashes; the hash of a
+      key that isn't in the set still maps to some index, so callers that
+      might look up other keys need to check what is stored there.
+
+      Returns NULL if two of the hashes are the same, since no function
+      can tell those keys apart.
+         hashes : the hash of each key.
+         n : number of keys.
+    **/
+Mph *Mph_Build (unsigned int *hashes,
+                int n);
+
+   /**
+      Free the given hash.
+         mph : hash to free. **/
+void Mph_Free (Mph *mph);
+
+   /**
+      The index of the key with the given hash. The hash must have been
+      built over at least one key.
+         mph : hash to use.
+         hash : the key's hash. **/
+int Mph_Index (Mph *mph,
+               unsigned int hash);
+
+#endif
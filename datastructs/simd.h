@@ -0,0 +1,137 @@
+
+/* Helpers for scanning byte arrays several bytes at a time. These use AVX2 or
+   SSE2 when the compiler targets them and fall back to plain loops otherwise,
+   so callers don't need to care which is available. */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+   /**
+      Count the bytes in p[0..n) which are equal to c.
+   **/
+static inline long Simd_Count (const char *p, long n, char c)
+{
+   long count = 0;
+   long i = 0;
+#if defined(__AVX2__)
+   __m256i needle = _mm256_set1_epi8(c);
+   for (; n - i >= 32; i += 32) {
+      __m256i block = _mm256_loadu_si256((const __m256i *)(p + i));
+      unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+      count += __builtin_popcount(mask);
+   }
+#elif defined(__SSE2__)
+   __m128i needle = _mm_set1_epi8(c);
+   for (; n - i >= 16; i += 16) {
+      __m128i block = _mm_loadu_si128((const __m128i *)(p + i));
+      unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+      count += __builtin_popcount(mask);
+   }
+#endif
+   for (; i < n; i++) {
+      count += p[i] == c;
+   }
+   return count;
+}
+
+   /**
+      Return the index of the first byte in p[0..n) which is equal to c (if
+      eq is non-zero) or not equal to c (if eq is zero). Returns n if there
+      isn't one.
+   **/
+static inline long Simd_Find (const char *p, long n, char c, int eq)
+{
+   long i = 0;
+#if defined(__AVX2__)
+   __m256i needle = _mm256_set1_epi8(c);
+   unsigned int flip = eq ? 0 : 0xFFFFFFFFu;
+   for (; n - i >= 32; i += 32) {
+      __m256i block = _mm256_loadu_si256((const __m256i *)(p + i));
+      unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)) ^ flip;
+      if (mask != 0) return i + __builtin_ctz(mask);
+   }
+#elif defined(__SSE2__)
+   __m128i needle = _mm_set1_epi8(c);
+   unsigned int flip = eq ? 0 : 0xFFFFu;
+   for (; n - i >= 16; i += 16) {
+      __m128i block = _mm_loadu_si128((const __m128i *)(p + i));
+      unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)) ^ flip;
+      if (mask != 0) return i + __builtin_ctz(mask);
+   }
+#endif
+   for (; i < n; i++) {
+      if ((p[i] == c) == !!eq) return i;
+   }
+   return n;
+}
+
+   /**
+      Return the index of the first element in p[0..n) equal to *elem, where
+      elements are size bytes each and size is 1, 2, 4 or 8. Elements are
+      compared bytewise. Returns n if there isn't one.
+   **/
+static inline long Simd_FindElem (const char *p, long n, const char *elem, int size)
+{
+   if (size == 1)
+      return Simd_Find(p, n, *elem, 1);
+
+   long i = 0;
+#if defined(__AVX2__)
+   __m256i needle;
+   unsigned short v16; unsigned int v32; unsigned long long v64;
+   switch (size) {
+      case 2: memcpy(&v16, elem, 2); needle = _mm256_set1_epi16(v16); break;
+      case 4: memcpy(&v32, elem, 4); needle = _mm256_set1_epi32(v32); break;
+      default: memcpy(&v64, elem, 8); needle = _mm256_set1_epi64x(v64); break;
+   }
+   long per = 32 / size;
+   for (; n - i >= per; i += per) {
+      __m256i block = _mm256_loadu_si256((const __m256i *)(p + i * size));
+      __m256i eq;
+      switch (size) {
+         case 2: eq = _mm256_cmpeq_epi16(block, needle); break;
+         case 4: eq = _mm256_cmpeq_epi32(block, needle); break;
+         default: eq = _mm256_cmpeq_epi64(block, needle); break;
+      }
+      unsigned int mask = _mm256_movemask_epi8(eq);
+      if (mask != 0) return i + __builtin_ctz(mask) / size;
+   }
+#elif defined(__SSE2__)
+   __m128i needle;
+   unsigned short v16; unsigned int v32; unsigned long long v64;
+   switch (size) {
+      case 2: memcpy(&v16, elem, 2); needle = _mm_set1_epi16(v16); break;
+      case 4: memcpy(&v32, elem, 4); needle = _mm_set1_epi32(v32); break;
+      default: memcpy(&v64, elem, 8); needle = _mm_set1_epi64x(v64); break;
+   }
+   long per = 16 / size;
+   for (; n - i >= per; i += per) {
+      __m128i block = _mm_loadu_si128((const __m128i *)(p + i * size));
+      __m128i eq;
+      switch (size) {
+         case 2: eq = _mm_cmpeq_epi16(block, needle); break;
+         case 4: eq = _mm_cmpeq_epi32(block, needle); break;
+         default:
+            // SSE2 has no 64-bit compare, so both halves have to match.
+            eq = _mm_cmpeq_epi32(block, needle);
+            eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, 0xB1));
+            break;
+      }
+      unsigned int mask = _mm_movemask_epi8(eq);
+      if (mask != 0) return i + __builtin_ctz(mask) / size;
+   }
+#endif
+   for (; i < n; i++) {
+      if (!memcmp(p + i * size, elem, size)) return i;
+   }
+   return n;
+}
+
+#endif
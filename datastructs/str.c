@@ -4,17 +4,36 @@
 // ============================================================
 
 
+#include <stdatomic.h>
+
 #include "str.h"
 
 
 // Definitions.
 // ============================================================
 
-struct str {
-   int len;
-   char *chars;
+// struct str is defined in str.h, so Strs can live on the stack.
+
+#define CHARS(str) ((str)->len < STR_INLINE ? (str)->chars.small : (str)->chars.heap)
+
+   /**
+      An intern table: an open-addressing hash set of canonical Strs, with
+      linear probing. It is kept at most half full. The Strs themselves
+      live in the table's arena.
+   **/
+struct str_table {
+   Arena *arena;
+   Str **slots;
+   int capacity;
+   int count;
 };
 
+// Serial numbers are unique across all tables. Tables belonging to different
+// programs may be filled on different threads, so the counter is atomic.
+static atomic_int intern_serial = 0;
+
+#define INTERN_INITIAL 64
+
 static inline void out_of_bounds (void);
 char *Str_Guts(Str *s1);
 
@@ -29,6 +48,48 @@ static inline void out_of_bounds ()
    abort();
 }
 
+static unsigned int djb2 (char *chars, int len)
+{
+   unsigned int hash = 5381;
+   int i;
+   for (i=0; i < len; i++) {
+      hash = ((hash << 5) + hash) + chars[i];
+   }
+   return hash;
+}
+
+   /**
+      Find the slot in the intern table holding the given contents, or the
+      empty slot where they would go.
+   **/
+static int intern_slot (StrTable *table, char *chars, int len, unsigned int hash)
+{
+   int mask = table->capacity - 1;
+   int i = hash & mask;
+   while (table->slots[i] != NULL) {
+      Str *s = table->slots[i];
+      if (s->hash == hash && s->len == len && !memcmp(CHARS(s), chars, len))
+         return i;
+      i = (i + 1) & mask;
+   }
+   return i;
+}
+
+static void intern_grow (StrTable *table)
+{
+   Str **old = table->slots;
+   int old_capacity = table->capacity;
+   table->capacity = old_capacity * 2;
+   table->slots = calloc(table->capacity, sizeof(Str *));
+   int i;
+   for (i=0; i < old_capacity; i++) {
+      Str *s = old[i];
+      if (s != NULL)
+         table->slots[intern_slot(table, CHARS(s), s->len, s->hash)] = s;
+   }
+   free(old);
+}
+
 
 
 // Public functions.
@@ -38,7 +99,7 @@ char Str_CharAt (Str *str, int index)
 {
    if (index < 0 || index >= str->len)
       out_of_bounds();
-   return str->chars[index];
+   return CHARS(str)[index];
 }
 
 int Str_Len (Str *str)
@@ -46,32 +107,64 @@ int Str_Len (Str *str)
    return str->len;
 }
 
+char *Str_Chars (Str *str)
+{
+   return CHARS(str);
+}
+
+void Str_Init (Str *str, char *chars, int len)
+{
+   str->len = len;
+   str->interned = 0;
+   str->hash = 0;
+   char *dest = str->chars.small;
+   if (len >= STR_INLINE)
+      dest = str->chars.heap = malloc(len + 1);
+   memcpy(dest, chars, len);
+   dest[len] = '\0';
+}
+
+Str *Str_MakeChars (char *chars, int len)
+{
+   Str *str = malloc(sizeof (struct str));
+   Str_Init(str, chars, len);
+   return str;
+}
+
 Str *Str_Make (char *contents)
 {
-   int count = 0;
-   while (*(contents+count) != '\0')
-      count++;
-   struct str *str = malloc(sizeof (struct str));
-   str->len = count;
-   str->chars = malloc(sizeof (char) * count);
-   memcpy(str->chars, contents, sizeof (char) * count);
+   return Str_MakeChars(contents, strlen(contents));
+}
+
+Str *Str_MakeIn (Arena *arena, char *chars, int len)
+{
+   Str *str = Arena_Alloc(arena, sizeof (struct str));
+   str->len = len;
+   str->interned = 0;
+   str->hash = 0;
+   char *dest = str->chars.small;
+   if (len >= STR_INLINE)
+      dest = str->chars.heap = Arena_Alloc(arena, len + 1);
+   memcpy(dest, chars, len);
+   dest[len] = '\0';
    return str;
 }
 
 Str *Str_Copy (Str *toCopy)
 {
-   Str *s = malloc(Str_SizeOf());
-   s->len = toCopy->len;
-   s->chars = malloc(sizeof(char) * s->len);
-   memcpy(s->chars, toCopy->chars, toCopy->len);
-   return s;
+   if (toCopy->interned)
+      return toCopy;
+   return Str_MakeChars(CHARS(toCopy), toCopy->len);
 }
 
 void Str_Free (Str *str)
 {
-   free(str->chars);
-   str->chars = NULL;
-   str = NULL;
+   if (str->interned)
+      return;
+   if (str->len >= STR_INLINE)
+      free(str->chars.heap);
+   str->len = 0;
+   str->chars.small[0] = '\0';
 }
 
 int Str_Cmp (Str *str1, Str *str2)
@@ -82,7 +175,7 @@ int Str_Cmp (Str *str1, Str *str2)
    int difference = maximum - minimum;
    int i;
    for (i=0; i < minimum; i++) {
-      if (str1->chars[i] != str2->chars[i]) difference++;
+      if (CHARS(str1)[i] != CHARS(str2)[i]) difference++;
    }
    return difference;
 }
@@ -91,7 +184,7 @@ char *Str_Guts (Str *str)
 {
    char *s = malloc(Str_Len(str) + 1);
    int len = Str_Len(str);
-   memcpy(s, str->chars, len);
+   memcpy(s, CHARS(str), len);
    s[len] = '\0';
    return s;
 }
@@ -102,7 +195,7 @@ int Str_ToInt (Str *str)
    // Preliminary checks.
    if (str == NULL) goto null;
    if (str->len == 0) goto err;
-   char *txt = str->chars;   
+   char *txt = CHARS(str);
 
    // Check for the sign.
    int sign = 1;
@@ -122,7 +215,7 @@ int Str_ToInt (Str *str)
 
    // Error handling.
    err:
-      fprintf(stderr, "Illegal conversion of string %s to integer.", str->chars);
+      fprintf(stderr, "Illegal conversion of string %s to integer.", CHARS(str));
       abort();
    null:
       fprintf(stderr, "Trying to convert null Str to itneger.");
@@ -135,7 +228,7 @@ int Str_Eq (Str *str, char *txt)
 {
    int i = 0;
    while (txt[i] != '\0' && i < str->len) {
-      if (txt[i] != str->chars[i]) return 0;
+      if (txt[i] != CHARS(str)[i]) return 0;
       i++;
    }
    return i == str->len && txt[i] == '\0';
@@ -145,7 +238,7 @@ int Str_EqIgnoreCase (Str *str, char *txt)
 {
    int i = 0;
    while (txt[i] != '\0' && i < str->len) {
-      if (tolower(txt[i]) != tolower(str->chars[i])) return 0;
+      if (tolower(txt[i]) != tolower(CHARS(str)[i])) return 0;
       i++;
    }
    return i == str->len && txt[i] == '\0';
@@ -155,3 +248,80 @@ int Str_SizeOf ()
 {
    return sizeof(struct str);
 }
+
+StrTable *StrTable_Make (Arena *arena)
+{
+   StrTable *table = malloc(sizeof (struct str_table));
+   table->arena = arena;
+   table->capacity = INTERN_INITIAL;
+   table->count = 0;
+   table->slots = calloc(table->capacity, sizeof(Str *));
+   return table;
+}
+
+void StrTable_Free (StrTable *table)
+{
+   free(table->slots);
+   free(table);
+}
+
+Str *Str_Intern (StrTable *table, Str *str)
+{
+   return Str_InternChars(table, CHARS(str), str->len);
+}
+
+Str *Str_InternChars (StrTable *table, char *chars, int len)
+{
+
+   // Look for it in the table.
+   if (2 * (table->count + 1) > table->capacity)
+      intern_grow(table);
+   unsigned int hash = djb2(chars, len);
+   int slot = intern_slot(table, chars, len, hash);
+   if (table->slots[slot] != NULL)
+      return table->slots[slot];
+
+   // Make the canonical copy. Each one gets its own serial number, which
+   // is what struct copies of it (e.g. map keys) are compared by.
+   Str *str = Str_MakeIn(table->arena, chars, len);
+   str->interned = atomic_fetch_add(&intern_serial, 1) + 1;
+   str->hash = hash;
+   table->slots[slot] = str;
+   table->count++;
+   return str;
+
+}
+
+void Str_InitInterned (Str *str, char *chars, int len, unsigned int hash)
+{
+   str->len = len;
+   str->interned = atomic_fetch_add(&intern_serial, 1) + 1;
+   str->hash = hash;
+   if (len >= STR_INLINE) {
+      str->chars.heap = chars;
+      return;
+   }
+   memcpy(str->chars.small, chars, len);
+   str->chars.small[len] = '\0';
+}
+
+unsigned int Str_Hash (Str *str)
+{
+   if (str->interned)
+      return str->hash;
+   return djb2(CHARS(str), str->len);
+}
+
+int Str_Same (Str *str1, Str *str2)
+{
+   if (str1->interned && str1->interned == str2->interned)
+      return 1;
+   if (str1->interned && str2->interned && str1->hash != str2->hash)
+      return 0;
+   return str1->len == str2->len && !memcmp(CHARS(str1), CHARS(str2), str1->len);
+}
+
+int Str_IsInterned (Str *str)
+{
+   return str->interned != 0;
+}
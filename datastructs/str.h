@@ -10,8 +10,32 @@
 #include <string.h>
 #include <ctype.h>
 
+#include "arena.h"
+
 
 typedef struct str Str;
+typedef struct str_table StrTable;
+
+   /**
+      The layout of a Str. It's only here so that Strs can be put on the
+      stack or inside other structs (see Str_Init); use the functions below
+      rather than the fields. Strs shorter than STR_INLINE are stored inline,
+      so most identifiers take no allocation beyond the struct itself. The
+      contents are always NUL-terminated.
+         interned : 0, or the serial number of an interned Str.
+         hash : the hash of the contents, if interned.
+   **/
+#define STR_INLINE 16
+
+struct str {
+   int len;
+   int interned;
+   unsigned int hash;
+   union {
+      char *heap;
+      char small[STR_INLINE];
+   } chars;
+};
 
 
 char Str_CharAt (Str *str,
@@ -23,6 +47,28 @@ int Str_Cmp (Str *str1, Str *str2);
 
 Str *Str_Make (char *contents);
 
+   /**
+      Make a Str from len chars, which don't need to be NUL-terminated.
+   **/
+Str *Str_MakeChars (char *chars, int len);
+
+   /**
+      Initialise a Str in memory the caller provides, e.g. on the stack. A
+      long Str still allocates its contents, so call Str_Free when done.
+   **/
+void Str_Init (Str *str, char *chars, int len);
+
+   /**
+      Make a Str whose struct and contents are allocated from an arena. It
+      is freed along with the arena, so don't call Str_Free on it.
+   **/
+Str *Str_MakeIn (Arena *arena, char *chars, int len);
+
+   /**
+      The contents of the Str as a C string. This is owned by the Str.
+   **/
+char *Str_Chars (Str *str);
+
 Str *Str_Copy (Str *other);
 
 void Str_Free (Str *str);
@@ -37,4 +83,42 @@ int Str_EqIgnoreCase (Str *str, char *txt);
 
 int Str_SizeOf ();
 
+   /**
+      Interning. A StrTable holds canonical copies of strings, allocated
+      from the given arena. Str_Intern returns the canonical Str with the
+      same contents as str, adding it to the table if it isn't there yet.
+      Interned Strs live until the arena is freed (StrTable_Free only frees
+      the table's index). Str_Free leaves them alone and Str_Copy hands back
+      the same pointer, so they can be passed around as freely as ordinary
+      Strs without any copying.
+         Str_Hash : hash of the contents. Free for an interned Str (it is
+            worked out once, when the Str is interned).
+         Str_Same : whether two Strs have the same contents. Two Strs
+            interned in the same table are compared by serial number.
+         Str_IsInterned : whether str is a canonical interned Str (or a
+            struct copy of one).
+   **/
+StrTable *StrTable_Make (Arena *arena);
+
+void StrTable_Free (StrTable *table);
+
+Str *Str_Intern (StrTable *table, Str *str);
+
+Str *Str_InternChars (StrTable *table, char *chars, int len);
+
+   /**
+      Make str a canonical interned Str for chars[0..len) without going
+      through a table, for names that are already known to be distinct
+      (such as those in a compiled program). Long names aren't copied, so
+      chars must be null-terminated and must outlive str. hash must be
+      what Str_Hash would give for the contents.
+   **/
+void Str_InitInterned (Str *str, char *chars, int len, unsigned int hash);
+
+unsigned int Str_Hash (Str *str);
+
+int Str_Same (Str *str1, Str *str2);
+
+int Str_IsInterned (Str *str);
+
 #endif
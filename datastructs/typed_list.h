@@ -0,0 +1,105 @@
+
+/* Type-specialised lists. LIST_DEFINE(Name, T, EQ) generates a list of T
+   called Name, with the element type and the equality test known at compile
+   time, so accesses are plain array indexing and Name_IndexOf can be inlined
+   (and vectorised for scalar T) instead of calling a comparator through a
+   pointer for each element. For example,
+
+      LIST_DEFINE(IntList, int, TYPED_EQ)
+
+   gives IntList_Make, IntList_Append, IntList_Get and so on, which behave
+   like their List counterparts in list.h but take and return ints by value.
+   The generated functions are static, so a list can be defined in each
+   file that needs it. */
+
+#ifndef TYPED_LIST_H
+#define TYPED_LIST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+   /**
+      Equality for types that can be compared with ==.
+    **/
+#define TYPED_EQ(a, b) ((a) == (b))
+
+#define LIST_DEFINE(Name, T, EQ) \
+\
+typedef struct Name { \
+   int len; \
+   int capacity; \
+   T *arr; \
+} Name; \
+\
+static inline Name *Name##_Make (int initial_capacity) \
+{ \
+   Name *list = malloc(sizeof (Name)); \
+   list->len = 0; \
+   list->capacity = initial_capacity > 0 ? initial_capacity : 1; \
+   list->arr = malloc(list->capacity * sizeof (T)); \
+   return list; \
+} \
+\
+static inline void Name##_Free (Name *list) \
+{ \
+   free(list->arr); \
+   free(list); \
+} \
+\
+static inline int Name##_Size (Name *list) \
+{ \
+   return list->len; \
+} \
+\
+static inline void Name##_Append (Name *list, T item) \
+{ \
+   if (list->len == list->capacity) { \
+      list->capacity *= 2; \
+      list->arr = realloc(list->arr, list->capacity * sizeof (T)); \
+   } \
+   list->arr[list->len++] = item; \
+} \
+\
+static inline T *Name##_At (Name *list, int index) \
+{ \
+   if (index < 0 || index >= list->len) { \
+      fprintf(stderr, "Trying to access list at illegal index."); \
+      abort(); \
+   } \
+   return list->arr + index; \
+} \
+\
+static inline T Name##_Get (Name *list, int index) \
+{ \
+   return *Name##_At(list, index); \
+} \
+\
+static inline void Name##_Set (Name *list, int index, T item) \
+{ \
+   *Name##_At(list, index) = item; \
+} \
+\
+static inline int Name##_IndexOf (Name *list, T item) \
+{ \
+   int i; \
+   for (i=0; i < list->len; i++) { \
+      if (EQ(list->arr[i], item)) return i; \
+   } \
+   return -1; \
+} \
+\
+static inline int Name##_Contains (Name *list, T item) \
+{ \
+   return Name##_IndexOf(list, item) != -1; \
+} \
+\
+static inline void Name##_Del (Name *list, int index) \
+{ \
+   Name##_At(list, index); \
+   memmove(list->arr + index, list->arr + index + 1, \
+           (list->len - index - 1) * sizeof (T)); \
+   list->len--; \
+}
+
+#endif
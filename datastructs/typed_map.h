@@ -0,0 +1,204 @@
+
+/* Type-specialised maps. MAP_DEFINE(Name, K, V, HASH, EQ) generates a map
+   from K to V called Name. It works like Map in map.h (an open-addressing
+   table with Robin Hood hashing) but keys and values are stored in typed
+   arrays, and HASH(key) and EQ(key1, key2) are expanded in place rather
+   than called through function pointers. HASH should return an unsigned
+   int; EQ should be non-zero when two keys are equal. For example,
+
+      MAP_DEFINE(StateMap, Str *, struct clause **, Str_Hash, Str_Same)
+
+   gives StateMap_Make, StateMap_Get, StateMap_Put and so on, plus
+   StateMap_Reserve and cursor iteration with StateMap_Next, as for Map.
+   Keys and values are copied in by value and nothing is freed on their
+   behalf. The
+   generated functions are static, so a map can be defined in each file
+   that needs it. */
+
+#ifndef TYPED_MAP_H
+#define TYPED_MAP_H
+
+#include <stdlib.h>
+
+#define TYPED_MAP_MIN 8
+#define TYPED_MAP_FULL 0x80000000u
+
+   /**
+      Scramble a hash so that weak hashes spread over the table. The result
+      always has TYPED_MAP_FULL set, so a stored hash of 0 means empty.
+    **/
+static inline unsigned int Typed_MapHash (unsigned int h)
+{
+   h ^= h >> 16;
+   h *= 0x45D9F3Bu;
+   h ^= h >> 16;
+   return h | TYPED_MAP_FULL;
+}
+
+#define MAP_DEFINE(Name, K, V, HASH, EQ) \
+\
+typedef struct Name { \
+   int capacity; \
+   int items; \
+   unsigned int *hashes; \
+   K *keys; \
+   V *vals; \
+} Name; \
+\
+static inline void Name##_Alloc (Name *map, int capacity) \
+{ \
+   map->capacity = capacity; \
+   map->items = 0; \
+   map->hashes = calloc(capacity, sizeof (unsigned int)); \
+   map->keys = malloc(capacity * sizeof (K)); \
+   map->vals = malloc(capacity * sizeof (V)); \
+} \
+\
+static inline Name *Name##_Make (int init_capacity) \
+{ \
+   Name *map = malloc(sizeof (Name)); \
+   int capacity = TYPED_MAP_MIN; \
+   while (capacity < init_capacity) capacity *= 2; \
+   Name##_Alloc(map, capacity); \
+   return map; \
+} \
+\
+static inline void Name##_Free (Name *map) \
+{ \
+   free(map->hashes); \
+   free(map->keys); \
+   free(map->vals); \
+   free(map); \
+} \
+\
+static inline int Name##_Size (Name *map) \
+{ \
+   return map->items; \
+} \
+\
+static inline int Name##_Distance (Name *map, int index) \
+{ \
+   int home = map->hashes[index] & (map->capacity - 1); \
+   return (index - home) & (map->capacity - 1); \
+} \
+\
+static inline int Name##_Find (Name *map, K key, unsigned int h) \
+{ \
+   int mask = map->capacity - 1; \
+   int i = h & mask; \
+   int dist = 0; \
+   while (map->hashes[i] != 0) { \
+      if (Name##_Distance(map, i) < dist) return -1; \
+      if (map->hashes[i] == h && EQ(map->keys[i], key)) return i; \
+      i = (i + 1) & mask; \
+      dist++; \
+   } \
+   return -1; \
+} \
+\
+static inline void Name##_Insert (Name *map, K key, V val, unsigned int h) \
+{ \
+   int mask = map->capacity - 1; \
+   int i = h & mask; \
+   int dist = 0; \
+   while (map->hashes[i] != 0) { \
+      int other = Name##_Distance(map, i); \
+      if (other < dist) { \
+         unsigned int swap_h = map->hashes[i]; \
+         K swap_k = map->keys[i]; \
+         V swap_v = map->vals[i]; \
+         map->hashes[i] = h; \
+         map->keys[i] = key; \
+         map->vals[i] = val; \
+         h = swap_h; \
+         key = swap_k; \
+         val = swap_v; \
+         dist = other; \
+      } \
+      i = (i + 1) & mask; \
+      dist++; \
+   } \
+   map->hashes[i] = h; \
+   map->keys[i] = key; \
+   map->vals[i] = val; \
+   map->items++; \
+} \
+\
+static inline void Name##_Resize (Name *map, int capacity) \
+{ \
+   Name old = *map; \
+   Name##_Alloc(map, capacity); \
+   int i; \
+   for (i=0; i < old.capacity; i++) { \
+      if (old.hashes[i] != 0) \
+         Name##_Insert(map, old.keys[i], old.vals[i], old.hashes[i]); \
+   } \
+   free(old.hashes); \
+   free(old.keys); \
+   free(old.vals); \
+} \
+\
+static inline int Name##_Contains (Name *map, K key) \
+{ \
+   return Name##_Find(map, key, Typed_MapHash(HASH(key))) != -1; \
+} \
+\
+static inline V *Name##_Get (Name *map, K key) \
+{ \
+   int index = Name##_Find(map, key, Typed_MapHash(HASH(key))); \
+   return index == -1 ? NULL : map->vals + index; \
+} \
+\
+static inline void Name##_Put (Name *map, K key, V val) \
+{ \
+   unsigned int h = Typed_MapHash(HASH(key)); \
+   int index = Name##_Find(map, key, h); \
+   if (index != -1) { \
+      map->vals[index] = val; \
+      return; \
+   } \
+   if ((map->items + 1) * 8 > map->capacity * 7) \
+      Name##_Resize(map, map->capacity * 2); \
+   Name##_Insert(map, key, val, h); \
+} \
+\
+static inline int Name##_Del (Name *map, K key) \
+{ \
+   int index = Name##_Find(map, key, Typed_MapHash(HASH(key))); \
+   if (index == -1) return 0; \
+   int mask = map->capacity - 1; \
+   int next = (index + 1) & mask; \
+   while (map->hashes[next] != 0 && Name##_Distance(map, next) > 0) { \
+      map->hashes[index] = map->hashes[next]; \
+      map->keys[index] = map->keys[next]; \
+      map->vals[index] = map->vals[next]; \
+      index = next; \
+      next = (next + 1) & mask; \
+   } \
+   map->hashes[index] = 0; \
+   map->items--; \
+   return 1; \
+} \
+\
+static inline void Name##_Reserve (Name *map, int items) \
+{ \
+   int capacity = map->capacity; \
+   while ((long)items * 8 > (long)capacity * 7) capacity *= 2; \
+   if (capacity > map->capacity) Name##_Resize(map, capacity); \
+} \
+\
+static inline int Name##_Next (Name *map, int *cursor, K *key, V **val) \
+{ \
+   int i; \
+   for (i = *cursor; i < map->capacity; i++) { \
+      if (map->hashes[i] == 0) continue; \
+      if (key) *key = map->keys[i]; \
+      if (val) *val = map->vals + i; \
+      *cursor = i + 1; \
+      return 1; \
+   } \
+   *cursor = map->capacity; \
+   return 0; \
+}
+
+#endif
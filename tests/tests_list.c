@@ -400,6 +400,57 @@ MU_TEST(test_big) {
 
 }
 
+   /**
+      Search lists of every element size that has a fast path, with
+      matches landing at each position within a block.
+   **/
+#define SEARCH_TEST(T) do {\
+   list = List_Make(4, sizeof(T), NULL, NULL);\
+   T items[100];\
+   int i;\
+   for (i=0; i < 100; i++) {\
+      items[i] = (T)(i % 50) * 3 + 1;\
+      List_Append(list, &items[i]);\
+   }\
+   for (i=0; i < 100; i++) {\
+      INDEX_TEST(&items[i], i % 50);\
+   }\
+   T missing = 2;\
+   MISSING_TEST(&missing);\
+   List_Free(list);\
+} while (0)
+
+MU_TEST(test_search_sizes) {
+   SEARCH_TEST(char);
+   SEARCH_TEST(short);
+   SEARCH_TEST(int);
+   SEARCH_TEST(long);
+}
+
+   /**
+      Grow a list past its inline elements and check nothing is lost, and
+      that List_At gives back pointers into the list.
+   **/
+MU_TEST(test_spill) {
+   list = List_Make(1, sizeof(int), NULL, NULL);
+   int i;
+   for (i=0; i < 100; i++) {
+      List_Append(list, &i);
+      int *first = List_At(list, 0);
+      mu_assert(*first == 0, "First element lost while growing.");
+   }
+   SIZE_TEST(100);
+   for (i=0; i < 100; i++) {
+      int *at = List_At(list, i);
+      mu_assert(*at == i, "Element in wrong index.");
+      *at = -i;
+   }
+   int x = -50;
+   INDEX_TEST(&x, 50);
+   mu_assert(List_At(list, 100) == NULL, "No element past the end.");
+   List_Free(list);
+}
+
 MU_TEST_SUITE(test_suite) {
    MU_SUITE_CONFIGURE(&Setup, &Teardown);
    MU_RUN_TEST(test_constructor);
@@ -412,6 +463,8 @@ MU_TEST_SUITE(test_suite) {
    MU_RUN_TEST(test_aliasing_2);
    MU_RUN_TEST(test_rebuild);
    MU_RUN_TEST(test_big);
+   MU_RUN_TEST(test_search_sizes);
+   MU_RUN_TEST(test_spill);
    MU_RUN_TEST(test_del);
    MU_RUN_TEST(test_del_2);
    MU_RUN_TEST(test_del_3);
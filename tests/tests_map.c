@@ -13,9 +13,9 @@
 #define NULL_CHECK(x) mu_assert(x != NULL, "Thing shouldn't be null.")
 #define NULL_TEST(x) mu_assert(x == NULL, "Thing should be null.")
 #define CONTAINS_TEST(x) mu_assert(Map_Contains(map, x), "Map should contain item.")
-#define MISSING_TEST(x) mu_assert(Map_Contains(map, x), "Map should not contain item.")
+#define MISSING_TEST(x) mu_assert(!Map_Contains(map, x), "Map should not contain item.")
 #define DELETED_TEST(x) mu_assert(Map_Del(map, x), "Map should have deleted something.")
-#define NOT_DELETED_TEST(x) mu_assert(Map_Del(map, x), "Map should not have deleted anything.")
+#define NOT_DELETED_TEST(x) mu_assert(!Map_Del(map, x), "Map should not have deleted anything.")
 
 
 // Set up.
@@ -71,7 +71,6 @@ MU_TEST (test_badhash_put) {
    // Should be able to retrieve value from key.
    int *result = Map_Get(map, &k);
    mu_assert(*result == v, "Should be able to retrieve value from key.");
-   free(result);
 
 }
 
@@ -90,7 +89,6 @@ MU_TEST (test_badhash_overwrite) {
    // Should be able to retrieve value from key.
    int *result = Map_Get(map, &k);
    mu_assert(*result == v, "Should be able to retrieve value from key.");
-   free(result);   
 
    // Add another value with same key.
    int v2 = 100;
@@ -103,7 +101,6 @@ MU_TEST (test_badhash_overwrite) {
    // Value retrieved should be different.
    result = Map_Get(map, &k);
    mu_assert(*result == v2, "Should have updated value in map.");
-   free(result);
 
 }
 
@@ -128,8 +125,6 @@ MU_TEST (test_badhash_collision) {
    int *r2 = Map_Get(map, &k2);
    mu_assert(*r1 == v1, "Should be able to retrieve value from key.");
    mu_assert(*r2 == v2, "Should be able to retrieve value from key.");
-   free(r1);
-   free(r2);
 
 }
 
@@ -149,7 +144,6 @@ MU_TEST (test_default_put)
    // Should be able to retrieve value from key.
    int *result = Map_Get(map, &k);
    mu_assert(*result == v, "Should be able to retrieve value from key.");
-   free(result);
 
 }
 
@@ -169,7 +163,6 @@ MU_TEST (test_default_overwrite) {
    // Should be able to retrieve value from key.
    int *result = Map_Get(map, &k);
    mu_assert(*result == v, "Should be able to retrieve value from key.");
-   free(result);   
 
    // Add another value with same key.
    int v2 = 100;
@@ -182,7 +175,6 @@ MU_TEST (test_default_overwrite) {
    // Value retrieved should be different.
    result = Map_Get(map, &k);
    mu_assert(*result == v2, "Should have updated value in map.");
-   free(result);
 
 }
 
@@ -207,8 +199,6 @@ MU_TEST (test_default_collision) {
    int *r2 = Map_Get(map, &k2);
    mu_assert(*r1 == v1, "Should be able to retrieve value from key.");
    mu_assert(*r2 == v2, "Should be able to retrieve value from key.");
-   free(r1);
-   free(r2);
 
 }
 MU_TEST (test_identityhash) {
@@ -228,7 +218,6 @@ MU_TEST (test_identityhash) {
       CONTAINS_TEST(&ints[i]);
       int *r = Map_Get(map, &ints[i]);
       mu_assert(*r == ints[i] * 2, "Should retrieve correct value from key.");
-      free(r);
    }
 
 }
@@ -250,7 +239,6 @@ MU_TEST (test_outofbounds) {
       CONTAINS_TEST(&ints[i]);
       int *r = Map_Get(map, &ints[i]);
       mu_assert(*r == ints[i], "Should retrieve correct value from key.");
-      free(r);
    }
 
 }
@@ -278,7 +266,6 @@ MU_TEST (test_rebuild) {
       CONTAINS_TEST(&ints[i]);
       int *r = Map_Get(map, &ints[i]);
       mu_assert(*r == squares[i], "Should retrieve correct value from key."); 
-      free(r);  
    }
 
 }
@@ -309,11 +296,155 @@ MU_TEST (stress_test) {
       CONTAINS_TEST(&ints[i]);
       int *r = Map_Get(map, &ints[i]);
       mu_assert(*r == squares[i], "Should retrieve correct value from key."); 
-      free(r);  
    }
 
 }
 
+MU_TEST (test_delete) {
+
+   // Put a bunch of colliding keys in the map, then delete every other one.
+   IntToIntMap(&BadHash);
+   int ints[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+   int i;
+   for (i=0; i < 8; i++) {
+      Map_Put(map, &ints[i], &ints[i]);
+   }
+   for (i=0; i < 8; i += 2) {
+      DELETED_TEST(&ints[i]);
+      NOT_DELETED_TEST(&ints[i]);
+   }
+
+   // The rest should still be there.
+   SIZE_TEST(4);
+   for (i=0; i < 8; i++) {
+      if (i % 2 == 0) {
+         MISSING_TEST(&ints[i]);
+         NULL_TEST(Map_Get(map, &ints[i]));
+      }
+      else {
+         CONTAINS_TEST(&ints[i]);
+         int *r = Map_Get(map, &ints[i]);
+         mu_assert(*r == ints[i], "Should retrieve correct value from key.");
+      }
+   }
+
+}
+
+MU_TEST (test_iterate) {
+
+   // Put some pairs in, then check iteration sees each exactly once.
+   IntToIntMap(NULL);
+   const int NUM_TEST = 300;
+   int seen[NUM_TEST];
+   int i;
+   for (i=0; i < NUM_TEST; i++) {
+      int sq = i * i;
+      Map_Put(map, &i, &sq);
+      seen[i] = 0;
+   }
+
+   int cursor = 0;
+   int count = 0;
+   void *key, *val;
+   while (Map_Next(map, &cursor, &key, &val)) {
+      int k = *(int *)key;
+      mu_assert(k >= 0 && k < NUM_TEST, "Iterated over a key not in the map.");
+      mu_assert(*(int *)val == k * k, "Iterated value doesn't match key.");
+      seen[k]++;
+      count++;
+   }
+   mu_assert(count == NUM_TEST, "Iteration should visit every pair.");
+   for (i=0; i < NUM_TEST; i++) {
+      mu_assert(seen[i] == 1, "Iteration should visit each pair once.");
+   }
+   mu_assert(!Map_Next(map, &cursor, NULL, NULL), "Finished iteration should stay finished.");
+
+}
+
+MU_TEST (test_iterate_empty) {
+   IntToIntMap(NULL);
+   int cursor = 0;
+   mu_assert(!Map_Next(map, &cursor, NULL, NULL), "Empty map has nothing to iterate.");
+}
+
+MU_TEST (test_putall) {
+
+   // Put a batch in, including a key that's already there.
+   IntToIntMap(&IdentityHash);
+   int k = 3, v = 0;
+   Map_Put(map, &k, &v);
+   int keys[] = { 1, 2, 3, 4, 5 };
+   int vals[] = { 10, 20, 30, 40, 50 };
+   Map_PutAll(map, keys, vals, 5);
+
+   SIZE_TEST(5);
+   int i;
+   for (i=0; i < 5; i++) {
+      int *r = Map_Get(map, &keys[i]);
+      mu_assert(r != NULL && *r == vals[i], "Should retrieve correct value from key.");
+   }
+
+}
+
+MU_TEST (test_reserve) {
+
+   // Reserving up front shouldn't change what goes in or comes out.
+   IntToIntMap(NULL);
+   Map_Reserve(map, 2000);
+   SIZE_TEST(0);
+   int i;
+   for (i=0; i < 2000; i++) {
+      int neg = -i;
+      Map_Put(map, &i, &neg);
+   }
+   SIZE_TEST(2000);
+   for (i=0; i < 2000; i++) {
+      int *r = Map_Get(map, &i);
+      mu_assert(r != NULL && *r == -i, "Should retrieve correct value from key.");
+   }
+
+}
+
+MU_TEST (test_shrink) {
+
+   // Fill the map, then empty most of it so it shrinks.
+   IntToIntMap(NULL);
+   const int NUM_TEST = 1000;
+   int i;
+   for (i=0; i < NUM_TEST; i++) {
+      Map_Put(map, &i, &i);
+   }
+   int full = Map_Capacity(map);
+   for (i=0; i < NUM_TEST; i++) {
+      if (i % 50 != 0) DELETED_TEST(&i);
+   }
+   int emptied = Map_Capacity(map);
+   mu_assert(emptied < full, "Deleting most pairs should shrink the table.");
+   Map_Shrink(map);
+   mu_assert(Map_Capacity(map) < emptied, "Shrinking should shrink the table further.");
+   mu_assert(Map_Capacity(map) / 2 * 7 < NUM_TEST / 50 * 8,
+             "Shrinking should leave the smallest table that fits.");
+
+   // Whatever is left should still be found.
+   SIZE_TEST(NUM_TEST / 50);
+   for (i=0; i < NUM_TEST; i++) {
+      if (i % 50 == 0) {
+         int *r = Map_Get(map, &i);
+         mu_assert(r != NULL && *r == i, "Should retrieve correct value from key.");
+      }
+      else {
+         MISSING_TEST(&i);
+      }
+   }
+
+   // And the map should still take new pairs.
+   int k = -1;
+   Map_Put(map, &k, &k);
+   CONTAINS_TEST(&k);
+   SIZE_TEST(NUM_TEST / 50 + 1);
+
+}
+
 
 // Running everything.
 // ======================================================================
@@ -345,6 +476,16 @@ MU_TEST_SUITE (test_suite)
    // Dealing with lots of stuff.
    MU_RUN_TEST(test_rebuild);
    MU_RUN_TEST(stress_test);
+
+   // Taking things out.
+   MU_RUN_TEST(test_delete);
+   MU_RUN_TEST(test_shrink);
+
+   // Going through everything, and putting lots in at once.
+   MU_RUN_TEST(test_iterate);
+   MU_RUN_TEST(test_iterate_empty);
+   MU_RUN_TEST(test_putall);
+   MU_RUN_TEST(test_reserve);
 }
 
 int main (int argc, char **argv)
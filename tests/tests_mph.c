@@ -0,0 +1,119 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mph.h"
+
+// Unit testing stuff.
+// ======================================================================
+
+#include "minunit.h"
+
+
+// Set up.
+// ======================================================================
+
+static Mph *mph;
+static unsigned int *hashes;
+static void Setup () {}
+static void Reset () {
+   if (mph != NULL) Mph_Free(mph);
+   free(hashes);
+   mph = NULL;
+   hashes = NULL;
+}
+
+   /**
+      Make n distinct hashes, spread out a bit.
+   **/
+static void Make_Hashes (int n)
+{
+   hashes = malloc((n + 1) * sizeof(unsigned int));
+   int i;
+   for (i=0; i < n; i++) {
+      hashes[i] = i * 2654435761u;
+   }
+}
+
+   /**
+      Check that every key gets its own index in [0, n).
+   **/
+static int Is_Perfect (int n)
+{
+   char *seen = calloc(n + 1, 1);
+   int i, ok = 1;
+   for (i=0; i < n; i++) {
+      int idx = Mph_Index(mph, hashes[i]);
+      if (idx < 0 || idx >= n || seen[idx]++) ok = 0;
+   }
+   free(seen);
+   return ok;
+}
+
+
+// Unit tests.
+// ======================================================================
+
+MU_TEST (test_one) {
+   Make_Hashes(1);
+   mph = Mph_Build(hashes, 1);
+   mu_check(mph != NULL);
+   mu_assert(Mph_Index(mph, hashes[0]) == 0, "Only key should have index 0.");
+}
+
+MU_TEST (test_small) {
+   int n;
+   for (n=2; n < 40; n++) {
+      Make_Hashes(n);
+      mph = Mph_Build(hashes, n);
+      mu_check(mph != NULL);
+      mu_assert(Is_Perfect(n), "Two keys share an index.");
+      Reset();
+   }
+}
+
+MU_TEST (test_large) {
+   Make_Hashes(10000);
+   mph = Mph_Build(hashes, 10000);
+   mu_check(mph != NULL);
+   mu_assert(Is_Perfect(10000), "Two keys share an index.");
+}
+
+MU_TEST (test_sequential) {
+   int i;
+   hashes = malloc(1000 * sizeof(unsigned int));
+   for (i=0; i < 1000; i++) {
+      hashes[i] = i;
+   }
+   mph = Mph_Build(hashes, 1000);
+   mu_check(mph != NULL);
+   mu_assert(Is_Perfect(1000), "Two keys share an index.");
+}
+
+MU_TEST (test_duplicate) {
+   Make_Hashes(10);
+   hashes[7] = hashes[2];
+   mph = Mph_Build(hashes, 10);
+   mu_assert(mph == NULL, "Duplicate hashes can't have a perfect hash.");
+}
+
+
+// Running everything.
+// ======================================================================
+
+MU_TEST_SUITE (test_suite)
+{
+   MU_SUITE_CONFIGURE(&Setup, &Reset);
+   MU_RUN_TEST(test_one);
+   MU_RUN_TEST(test_small);
+   MU_RUN_TEST(test_large);
+   MU_RUN_TEST(test_sequential);
+   MU_RUN_TEST(test_duplicate);
+}
+
+int main (int argc, char **argv)
+{
+   MU_RUN_SUITE(test_suite);
+   MU_REPORT();
+   return 0;
+}
@@ -0,0 +1,182 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "typed_list.h"
+#include "typed_map.h"
+
+// Unit testing stuff.
+// ======================================================================
+
+#include "minunit.h"
+
+#define SIZE_TEST(x) mu_assert(IntMap_Size(map) == x, "Wrong number of items in map.")
+
+
+// Containers under test.
+// ======================================================================
+
+static unsigned int BadHash (int i) { return 0; }
+static unsigned int IdentityHash (int i) { return i; }
+
+LIST_DEFINE(IntList, int, TYPED_EQ)
+MAP_DEFINE(IntMap, int, int, IdentityHash, TYPED_EQ)
+MAP_DEFINE(BadMap, int, int, BadHash, TYPED_EQ)
+
+struct point {
+   int x, y;
+};
+
+#define POINT_EQ(a, b) ((a).x == (b).x && (a).y == (b).y)
+LIST_DEFINE(PointList, struct point, POINT_EQ)
+
+
+// Set up.
+// ======================================================================
+
+static IntMap *map;
+static void Setup () {}
+static void Reset () {
+   if (map != NULL) IntMap_Free(map);
+   map = NULL;
+}
+
+
+// Unit tests.
+// ======================================================================
+
+MU_TEST (test_list_append) {
+   IntList *list = IntList_Make(1);
+   int i;
+   for (i=0; i < 100; i++) {
+      IntList_Append(list, i * i);
+   }
+   mu_assert(IntList_Size(list) == 100, "Wrong number of items in list.");
+   for (i=0; i < 100; i++) {
+      mu_assert(IntList_Get(list, i) == i * i, "Wrong item in list.");
+      mu_assert(IntList_IndexOf(list, i * i) == i, "Element in wrong index.");
+   }
+   mu_assert(!IntList_Contains(list, 3), "Element should be missing.");
+   IntList_Free(list);
+}
+
+MU_TEST (test_list_del) {
+   IntList *list = IntList_Make(4);
+   int i;
+   for (i=0; i < 5; i++) {
+      IntList_Append(list, i);
+   }
+   IntList_Del(list, 1);
+   IntList_Set(list, 0, 10);
+   mu_assert(IntList_Size(list) == 4, "Wrong number of items in list.");
+   mu_assert(IntList_Get(list, 0) == 10, "Set should overwrite the item.");
+   mu_assert(IntList_Get(list, 1) == 2, "Items should shift down after delete.");
+   mu_assert(IntList_IndexOf(list, 1) == -1, "Deleted item should be gone.");
+   IntList_Free(list);
+}
+
+MU_TEST (test_list_structs) {
+   PointList *list = PointList_Make(2);
+   struct point p = { 1, 2 }, q = { 3, 4 }, r = { 1, 4 };
+   PointList_Append(list, p);
+   PointList_Append(list, q);
+   mu_assert(PointList_IndexOf(list, q) == 1, "Element in wrong index.");
+   mu_assert(!PointList_Contains(list, r), "Element should be missing.");
+   PointList_At(list, 0)->y = 4;
+   mu_assert(PointList_IndexOf(list, r) == 0, "At should give access to the item.");
+   PointList_Free(list);
+}
+
+MU_TEST (test_map_put_get) {
+   map = IntMap_Make(0);
+   int i;
+   for (i=0; i < 1000; i++) {
+      IntMap_Put(map, i, -i);
+   }
+   SIZE_TEST(1000);
+   for (i=0; i < 1000; i++) {
+      int *v = IntMap_Get(map, i);
+      mu_assert(v != NULL && *v == -i, "Should retrieve correct value from key.");
+   }
+   mu_assert(IntMap_Get(map, 1000) == NULL, "Missing key should give null.");
+
+   // Overwriting doesn't add anything.
+   IntMap_Put(map, 5, 50);
+   SIZE_TEST(1000);
+   mu_assert(*IntMap_Get(map, 5) == 50, "Should have updated value in map.");
+}
+
+MU_TEST (test_map_del) {
+   map = IntMap_Make(16);
+   int i;
+   for (i=0; i < 200; i++) {
+      IntMap_Put(map, i, i);
+   }
+   for (i=0; i < 200; i += 2) {
+      mu_assert(IntMap_Del(map, i), "Map should have deleted something.");
+      mu_assert(!IntMap_Del(map, i), "Map should not have deleted anything.");
+   }
+   SIZE_TEST(100);
+   for (i=0; i < 200; i++) {
+      mu_assert(IntMap_Contains(map, i) == i % 2, "Wrong keys left after delete.");
+   }
+}
+
+MU_TEST (test_map_badhash) {
+   BadMap *bad = BadMap_Make(0);
+   int i;
+   for (i=0; i < 50; i++) {
+      BadMap_Put(bad, i, i * 2);
+   }
+   BadMap_Del(bad, 10);
+   for (i=0; i < 50; i++) {
+      int *v = BadMap_Get(bad, i);
+      if (i == 10) mu_assert(v == NULL, "Deleted key should be gone.");
+      else mu_assert(v != NULL && *v == i * 2, "Should retrieve correct value from key.");
+   }
+   BadMap_Free(bad);
+}
+
+MU_TEST (test_map_iterate) {
+   map = IntMap_Make(0);
+   IntMap_Reserve(map, 100);
+   int i;
+   for (i=0; i < 100; i++) {
+      IntMap_Put(map, i, 2 * i);
+   }
+   int cursor = 0, key, sum = 0, count = 0;
+   int *val;
+   while (IntMap_Next(map, &cursor, &key, &val)) {
+      mu_assert(*val == 2 * key, "Iterated value doesn't match key.");
+      sum += key;
+      count++;
+   }
+   mu_assert(count == 100 && sum == 99 * 100 / 2, "Iteration should visit every pair once.");
+}
+
+
+// Running everything.
+// ======================================================================
+
+MU_TEST_SUITE (test_suite)
+{
+   MU_SUITE_CONFIGURE(&Setup, &Reset);
+
+   // Lists.
+   MU_RUN_TEST(test_list_append);
+   MU_RUN_TEST(test_list_del);
+   MU_RUN_TEST(test_list_structs);
+
+   // Maps.
+   MU_RUN_TEST(test_map_put_get);
+   MU_RUN_TEST(test_map_del);
+   MU_RUN_TEST(test_map_badhash);
+   MU_RUN_TEST(test_map_iterate);
+}
+
+int main (int argc, char **argv)
+{
+   MU_RUN_SUITE(test_suite);
+   MU_REPORT();
+   return 0;
+}
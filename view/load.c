@@ -0,0 +1,50 @@
+
+/* Loads a library of programs and reports how long each file took. It takes
+   a directory, whose files are all loaded, or a list of files. Exits with a
+   non-zero status if any of them didn't load. */
+
+#include "load.h"
+
+static void usage (void)
+{
+   fprintf(stderr, "Usage: load [-j <threads>] <dir> | <prog>...\n");
+}
+
+int main (int argc, char **argv)
+{
+
+   // Options: number of threads.
+   int threads = 0;
+   if (argc >= 3 && strcmp(argv[1], "-j") == 0) {
+      threads = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+   }
+   if (argc < 2) {
+      usage();
+      return 1;
+   }
+
+   // A single directory is loaded whole.
+   struct stat st;
+   Library *lib;
+   if (argc == 2 && stat(argv[1], &st) == 0 && S_ISDIR(st.st_mode))
+      lib = Lib_LoadDir(argv[1], threads);
+   else
+      lib = Lib_LoadFiles(argv + 1, argc - 1, threads);
+   if (lib == NULL) {
+      fprintf(stderr, "Error reading directory: %s\n", argv[1]);
+      return 1;
+   }
+
+   Lib_Summary(lib, stdout);
+   int status = 0, i;
+   for (i=0; i < Lib_Size(lib); i++) {
+      if (Lib_Program(lib, i) == NULL) status = 2;
+   }
+
+   Lib_Free(lib);
+   Import_Clear();
+   return status;
+
+}
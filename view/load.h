@@ -0,0 +1,12 @@
+#ifndef LOAD_H
+#define LOAD_H
+
+   #include <stdio.h>
+   #include <stdlib.h>
+   #include <string.h>
+   #include <sys/stat.h>
+
+   #include "library.h"
+   #include "import.h"
+
+#endif
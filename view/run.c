@@ -0,0 +1,192 @@
+
+/* A headless runner for batch jobs. It runs a program to completion (or for a
+   maximum number of steps) and prints the result decoded off the tape. The
+   written part of the final tape can also be exported to a file.
+
+   Results are kept in a cache (see cache.h), so running the same program on
+   the same inputs again just looks the result up. Runs that need the tape
+   itself (with -t, -i or -o) skip the cache, and -C turns it off. */
+
+#include "run.h"
+
+#define MAX_PRINTED CACHE_NUMS
+
+static void usage (void)
+{
+   fprintf(stderr, "Usage: run [-t <tape-file> | -r] [-i <input-file>] "
+                   "[-n <max-steps>] [-o <output-file>] [-C] <prog> <args>\n");
+}
+
+static void print_result (Result *result, unsigned long hash)
+{
+   printf("steps: %ld\n", result->steps);
+   printf("halted: %s\n", result->halted ? "yes" : "no");
+   printf("ones: %ld\n", result->ones);
+   printf("hash: %016lx\n", hash);
+   printf("result:");
+   long i;
+   for (i=0; i < result->found && i < MAX_PRINTED; i++) {
+      printf(" %ld", result->nums[i]);
+   }
+   printf(result->found > MAX_PRINTED ? " ...\n" : "\n");
+}
+
+   /**
+      Whether a cached result answers a run of at most max_steps steps (or
+      as many as it takes, if max_steps is negative): it does if the
+      program halted within that many, or was stopped after exactly that
+      many.
+   **/
+static int answers (Result *result, long max_steps)
+{
+   if (result->halted)
+      return max_steps < 0 || result->steps <= max_steps;
+   return result->steps == max_steps;
+}
+
+int main (int argc, char **argv)
+{
+
+   // Options: tape backend, input file, step limit and output file.
+   char *tape_file = NULL;
+   char *input_file = NULL;
+   char *output_file = NULL;
+   long max_steps = -1;
+   int rle_tape = 0;
+   int use_cache = 1;
+   while (argc >= 2 && argv[1][0] == '-') {
+      if (strcmp(argv[1], "-r") == 0 || strcmp(argv[1], "-C") == 0) {
+         if (argv[1][1] == 'r') rle_tape = 1;
+         else use_cache = 0;
+         argc--;
+         argv++;
+         continue;
+      }
+      if (argc < 3) break;
+      if (strcmp(argv[1], "-t") == 0)      tape_file = argv[2];
+      else if (strcmp(argv[1], "-i") == 0) input_file = argv[2];
+      else if (strcmp(argv[1], "-o") == 0) output_file = argv[2];
+      else if (strcmp(argv[1], "-n") == 0) max_steps = atol(argv[2]);
+      else break;
+      argc -= 2;
+      argv += 2;
+   }
+   if (argc < 2) {
+      usage();
+      return 1;
+   }
+
+   // Parse the program.
+   Str *fname = Str_Make(argv[1]);
+   Program *prog = Parser_ProgFromFile(fname);
+   Str_Free(fname);
+   free(fname);
+   if (prog == NULL) {
+      fprintf(stderr, "Error reading file: %s\n", argv[1]);
+      return 1;
+   }
+   int num_inputs = Prog_NumInputs(prog);
+   int num_args = argc - 2;
+   if (input_file == NULL && num_inputs != PROG_ANY_INPUTS && num_args != num_inputs) {
+      fprintf(stderr, "Error: expected %d input(s) but received %d.\n", num_inputs, num_args);
+      Prog_Free(prog);
+      return 2;
+   }
+
+   // Look the result up, if the run doesn't need the tape.
+   Cache *cache = NULL;
+   Result result;
+   memset(&result, 0, sizeof(result));
+   int cached = 0;
+   if (use_cache && tape_file == NULL && input_file == NULL && output_file == NULL)
+      cache = Cache_OpenDefault();
+   if (cache != NULL) {
+      unsigned long fingerprint = Prog_Fingerprint(prog);
+      cached = Cache_Get(cache, fingerprint, argv + 2, num_args, &result);
+      Str *state = Prog_CanonicalState(prog, result.state);
+      if (cached && answers(&result, max_steps) && (state != NULL || result.state < 0)) {
+         print_result(&result, result.tape_hash ^ M_StateHash(state));
+         Cache_Close(cache);
+         Prog_Free(prog);
+         Import_Clear();
+         return 0;
+      }
+   }
+
+   // Make the tape and the machine.
+   Tape *tape;
+   if (tape_file != NULL)
+      tape = Tape_MakeMapped(tape_file);
+   else if (rle_tape)
+      tape = Tape_MakeRle();
+   else
+      tape = Tape_MakeChunked();
+   if (tape == NULL) {
+      fprintf(stderr, "Error creating tape file: %s\n", tape_file);
+      Prog_Free(prog);
+      return 1;
+   }
+
+   Machine *machine;
+   if (input_file != NULL) {
+      Tape *image = Tape_OpenMapped(input_file);
+      if (image != NULL) {
+         Tape_Del(tape);
+         machine = M_MakeFromTape(prog, image);
+      }
+      else {
+         machine = M_MakeFromImage(prog, input_file, tape);
+      }
+   }
+   else {
+      machine = M_MakeFromArgs(prog, argv + 2, num_args, tape);
+   }
+   if (machine == NULL) {
+      fprintf(stderr, "Error: could not load the inputs to the program.\n");
+      if (cache != NULL) Cache_Close(cache);
+      Prog_Free(prog);
+      return 3;
+   }
+
+   // Run the program.
+   long steps = 0;
+   while (!I_Halted(machine, prog) && steps != max_steps) {
+      I_Step(machine, prog);
+      steps++;
+   }
+
+   // Report the result.
+   result.steps = steps;
+   result.halted = I_Halted(machine, prog);
+   result.ones = M_Count(machine, '1');
+   result.tape_hash = M_TapeHash(machine);
+   result.found = M_DecodeUnary(machine, result.nums, MAX_PRINTED);
+   print_result(&result, M_Hash(machine));
+
+   // Cache it. A result that answers longer runs isn't replaced by one
+   // that was stopped short of it.
+   if (cache != NULL) {
+      Str *state = M_State(machine);
+      result.state = state == NULL ? -1 : Prog_CanonicalId(prog, state);
+      if ((!cached || result.halted) && (state == NULL || result.state >= 0))
+         Cache_Put(cache, Prog_Fingerprint(prog), argv + 2, num_args, &result);
+      Cache_Close(cache);
+   }
+
+   // Export the tape.
+   int status = 0;
+   if (output_file != NULL) {
+      int fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd == -1 || M_Export(machine, fd) == -1) {
+         fprintf(stderr, "Error writing output file: %s\n", output_file);
+         status = 4;
+      }
+      if (fd != -1) close(fd);
+   }
+
+   M_Del(machine);
+   Prog_Free(prog);
+   Import_Clear();
+   return status;
+
+}
@@ -0,0 +1,22 @@
+
+
+
+#ifndef RUN_H
+#define RUN_H
+
+   #include <fcntl.h>
+   #include <stdio.h>
+   #include <stdlib.h>
+   #include <string.h>
+   #include <unistd.h>
+
+   #include "cache.h"
+   #include "interpreter.h"
+   #include "parser.h"
+   #include "import.h"
+   #include "program.h"
+   #include "machine.h"
+
+   #include "str.h"
+
+#endif
@@ -12,6 +12,7 @@ struct gui {
    WINDOW *menu;
    WINDOW *tape;
    Machine *machine;
+   char status[PARSE_ERR_MAX + PATH_MAX];
 };
 
 typedef struct gui GUI;
@@ -51,6 +52,7 @@ void init_gui (GUI *gui, Machine *m)
 
    /** Associate gui with a machine. **/
    gui->machine = m;
+   gui->status[0] = '\0';
 
 }
 
@@ -61,10 +63,12 @@ void draw_menu (GUI *gui)
    WINDOW *window = gui->menu;
 
    // The menu is an array.
-   int num_items = 2;
+   int num_items = 4;
    char *menu[num_items];
    menu[0] = "Step";
    menu[1] = "Run";
+   menu[2] = "Fork (f)";
+   menu[3] = "Back to fork (b)";
 
    // Draw the menu.
    int i;
@@ -76,6 +80,9 @@ void draw_menu (GUI *gui)
       mvwprintw(window, offset_top + i, offset_left, menu[i]);
    }
 
+   // Say what happened the last time the program was reloaded.
+   mvwprintw(window, offset_top + num_items + 1, offset_left, "%s", gui->status);
+
 }
 
 void draw_tape (GUI *gui)
@@ -99,12 +106,16 @@ void draw_tape (GUI *gui)
       mvwaddch(w, 3, i, '-');   
    }
 
+   // Read the visible part of the tape in one go. Index cols/2 is the head.
+   char cells[cols + 1];
+   M_ReadRange(m, M_Head(m) - cols/2, cols + 1, cells);
+
    // Draw contents of tape left of the head.
    int offset = 0;
    int should_draw = 1;
    for (i=cols/2; i >= 0; i--) {
       if (should_draw == 1) {
-         char c = M_CharAtHead(m, offset);
+         char c = cells[cols/2 + offset];
          mvwaddch(w, 2, i, c);         
          offset--;
          should_draw = 0;
@@ -120,7 +131,7 @@ void draw_tape (GUI *gui)
    should_draw = 1;
    for (i=cols/2; i < cols; i++) {
       if (should_draw == 1) {
-         char c = M_CharAtHead(m, offset);
+         char c = cells[cols/2 + offset];
          mvwaddch(w, 2, i, c);         
          offset++;
          should_draw = 0;
@@ -162,80 +173,280 @@ void end_gui (GUI *gui)
    endwin();
 }
 
+
+
+
+// Starting and reloading the machine.
+// ============================================================
+
+   /**
+      What the machine was started with, so that it can be started again.
+         tape_file : file to keep the tape in, or NULL.
+         input_file : file to load the tape from, or NULL.
+         rle_tape : whether to run-length encode the tape.
+         args : the inputs, if there's no input file.
+         num_args : how many inputs there are.
+   **/
+struct setup {
+   char *tape_file;
+   char *input_file;
+   int rle_tape;
+   char **args;
+   int num_args;
+};
+
+   /**
+      Make a machine to run prog, as set up. Returns NULL if it can't, with
+      the reason in error (which has room for size characters) and the
+      status to exit with in status.
+   **/
+static Machine *start_machine (Program *prog, struct setup *setup,
+                               char *error, int size, int *status)
+{
+
+   // Check we have correct number of inputs to program.
+   int num_inputs = Prog_NumInputs(prog);
+   if (setup->input_file == NULL && num_inputs != PROG_ANY_INPUTS
+       && setup->num_args != num_inputs) {
+      snprintf(error, size, "Error: expected %d input(s) but received %d.",
+               num_inputs, setup->num_args);
+      *status = 2;
+      return NULL;
+   }
+
+   // Make the tape.
+   Tape *tape;
+   if (setup->tape_file != NULL)
+      tape = Tape_MakeMapped(setup->tape_file);
+   else if (setup->rle_tape)
+      tape = Tape_MakeRle();
+   else
+      tape = Tape_MakeChunked();
+   if (tape == NULL) {
+      snprintf(error, size, "Error creating tape file: %s", setup->tape_file);
+      *status = 1;
+      return NULL;
+   }
+
+   // Construct the turing machine, loading the inputs onto the tape. An
+   // input file that is a tape image from a previous run is copied as is.
+   Machine *machine;
+   if (setup->input_file != NULL) {
+      Tape *image = Tape_OpenMapped(setup->input_file);
+      if (image != NULL) {
+         Tape_Del(tape);
+         machine = M_MakeFromTape(prog, image);
+      }
+      else {
+         machine = M_MakeFromImage(prog, setup->input_file, tape);
+      }
+      if (machine == NULL) {
+         snprintf(error, size, "Error reading input file: %s", setup->input_file);
+         *status = 3;
+      }
+   }
+   else {
+      machine = M_MakeFromArgs(prog, setup->args, setup->num_args, tape);
+      if (machine == NULL) {
+         snprintf(error, size, "Error: the arguments are not valid inputs to the program.");
+         *status = 3;
+      }
+   }
+   return machine;
+
+}
+
+   /**
+      Whether any of the pending inotify events on watch are for the file
+      called name.
+   **/
+static int file_changed (int watch, char *name)
+{
+   char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+   int changed = 0;
+   long len;
+   while ((len = read(watch, buf, sizeof(buf))) > 0) {
+      char *p = buf;
+      while (p < buf + len) {
+         struct inotify_event *ev = (struct inotify_event *)p;
+         if (ev->len > 0 && strcmp(ev->name, name) == 0) changed = 1;
+         p += sizeof(struct inotify_event) + ev->len;
+      }
+   }
+   return changed;
+}
+
+   /**
+      Parse the program file again and swap the new version in. The machine
+      carries on with its tape and head if its state is still there, and
+      starts again from its inputs if it isn't. If the new version doesn't
+      parse, the old one is kept. The outcome is left in the gui's status.
+   **/
+static void reload (GUI *gui, Program **prog, Machine **checkpoint,
+                    struct setup *setup, char *fname)
+{
+   char err[PARSE_ERR_MAX];
+   err[0] = '\0';
+   Program *new = Parser_Load(fname, 0, err, sizeof(err));
+   if (new == NULL) {
+      snprintf(gui->status, sizeof(gui->status), "Not reloaded: %s",
+               err[0] != '\0' ? err : "could not read the file.");
+      return;
+   }
+
+   // Keep the machine where it is if we can.
+   Machine *machine = gui->machine;
+   if (M_Rebind(machine, *prog, new)) {
+      if (*checkpoint != NULL && !M_Rebind(*checkpoint, *prog, new)) {
+         M_Del(*checkpoint);
+         *checkpoint = NULL;
+      }
+      snprintf(gui->status, sizeof(gui->status), "Reloaded.");
+   }
+
+   // Otherwise start again. The old machine goes first, since the new one
+   // may use the same tape file.
+   else {
+      Str *state = M_State(machine);
+      char name[PATH_MAX];
+      snprintf(name, sizeof(name), "%s", Str_Chars(state));
+      M_Del(machine);
+      if (*checkpoint != NULL) M_Del(*checkpoint);
+      *checkpoint = NULL;
+      int status;
+      machine = start_machine(new, setup, err, sizeof(err), &status);
+      if (machine == NULL) {
+         // There's nothing left to run the old version on either.
+         endwin();
+         fprintf(stderr, "%s\n", err);
+         exit(status);
+      }
+      gui->machine = machine;
+      snprintf(gui->status, sizeof(gui->status),
+               "Reloaded; state %s is gone, so the machine started again.", name);
+   }
+   Prog_Free(*prog);
+   *prog = new;
+}
+
+
+
+// Main loop.
+// ============================================================
+
 int main (int argc, char **argv)
 {
 
+   // Optionally keep the tape in a memory-mapped file (-t <file>), or
+   // run-length encode it (-r). The input tape can be loaded from a file
+   // (-i <file>) instead of being given as arguments.
+   struct setup setup = { NULL, NULL, 0, NULL, 0 };
+   while (argc >= 2 && argv[1][0] == '-') {
+      if (strcmp(argv[1], "-t") == 0 && argc >= 3) {
+         setup.tape_file = argv[2];
+         argc--;
+         argv++;
+      }
+      else if (strcmp(argv[1], "-i") == 0 && argc >= 3) {
+         setup.input_file = argv[2];
+         argc--;
+         argv++;
+      }
+      else if (strcmp(argv[1], "-r") == 0) {
+         setup.rle_tape = 1;
+      }
+      else {
+         break;
+      }
+      argc--;
+      argv++;
+   }
+
    // Check for correct number of arguments.
    if (argc < 2) {
-      fprintf(stderr, "Usage: sim.c <prog> <args>\n");
+      fprintf(stderr, "Usage: sim.c [-t <tape-file> | -r] [-i <input-file>] <prog> <args>\n");
       return 1;
    }
-   
-   // Get filename, parse contents.
-   Str *fname = Str_Make(argv[1]);
-   Program *prog = Parser_ProgFromFile(fname);
-
-   // Parse file, checking for an IO error.
+   char *fname = argv[1];
+   setup.args = argv + 2;
+   setup.num_args = argc - 2;
+
+   // Parse the file, checking for an IO error.
+   Str *fname_str = Str_Make(fname);
+   Program *prog = Parser_ProgFromFile(fname_str);
+   Str_Free(fname_str);
+   free(fname_str);
    if (prog == NULL) {
-      char *s = Str_Guts(fname);
-      fprintf(stderr, "Error reading file: %s\n", s);
-      free(s);
+      fprintf(stderr, "Error reading file: %s\n", fname);
       return 1;
    }
 
-   // Free the file name.
-   Str_Free(fname);
-   
-   // Check we have correct number of inputs to program.
-   int num_inputs = Prog_NumInputs(prog);
-   
-   if (argc - 2 != num_inputs) {
-      fprintf(stderr, "Error: expected %d input(s) but received %d.\n", num_inputs, argc - 2);
+   // Construct the turing machine.
+   char err[PATH_MAX + 64];
+   int status;
+   Machine *machine = start_machine(prog, &setup, err, sizeof(err), &status);
+   if (machine == NULL) {
+      fprintf(stderr, "%s\n", err);
       Prog_Free(prog);
-      return 2;
+      return status;
    }
+   GUI *gui = malloc(sizeof(GUI));
+   init_gui(gui, machine);
 
-   // Load the inputs to the program.
-   int inputs[num_inputs];
-   int i;
-   for (i = 2; i < 2 + num_inputs; i++) {
-   
-      // Check that this is a number.
-      int k;
-      for (k = 0; argv[i][k] != '\0'; k++) {
-         if (!isdigit(argv[i][k])) {
-            fprintf(stderr, "Error: the argument \"%s\" is not a number.\n", argv[i]);
-            Prog_Free(prog);
-            return 3;
-         }
-      }
-      
-      // Convert char * to number and load into inputs array.
-      inputs[i-2] = atoi(argv[i]);
+   // Watch the program for changes. The watch is on its directory, since
+   // editors often save by writing a new file and renaming it over the old
+   // one, which a watch on the file itself would lose track of.
+   char *slash = strrchr(fname, '/');
+   char *base = slash == NULL ? fname : slash + 1;
+   char dir[PATH_MAX];
+   snprintf(dir, sizeof(dir), "%.*s", slash == NULL ? 1 : (int)(slash - fname + 1),
+            slash == NULL ? "." : fname);
+   int watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   if (watch != -1 && inotify_add_watch(watch, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+      close(watch);
+      watch = -1;
    }
 
-
-   // Construct the turing machine and the gui.
-   Machine *machine = M_Make(prog, inputs);
-   GUI *gui = malloc(sizeof(GUI));
-   init_gui(gui, machine);
-   
+   // A fork of the machine that the user can come back to.
+   Machine *checkpoint = NULL;
 
    while (1) {
    
-      // Draw and process user input.
-      gui_draw(gui);   
+      // Draw, then wait for user input or a change to the program.
+      gui_draw(gui);
+      struct pollfd fds[2] = { { STDIN_FILENO, POLLIN, 0 }, { watch, POLLIN, 0 } };
+      if (poll(fds, watch == -1 ? 1 : 2, -1) == -1)
+         continue;
+      if (watch != -1 && (fds[1].revents & POLLIN) && file_changed(watch, base))
+         reload(gui, &prog, &checkpoint, &setup, fname);
+      if (!(fds[0].revents & POLLIN))
+         continue;
       int input = getch();
+      machine = gui->machine;
 
       if (input == KEY_RIGHT) I_Step(machine, prog);      
       else if (input == KEY_ESC) break;
+
+      // Fork the machine, so you can try something and come back.
+      else if (input == 'f') {
+         if (checkpoint != NULL) M_Del(checkpoint);
+         checkpoint = M_Fork(machine);
+      }
+      else if (input == 'b' && checkpoint != NULL) {
+         M_Del(machine);
+         gui->machine = M_Fork(checkpoint);
+      }
       
    }
 
    // Tear down everything.
+   machine = gui->machine;
    end_gui(gui);
+   if (watch != -1) close(watch);
    Prog_Free(prog);
+   Import_Clear();
    M_Del(machine);
+   if (checkpoint != NULL) M_Del(checkpoint);
 
    return 0;
 
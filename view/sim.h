@@ -4,14 +4,19 @@
 #ifndef SIM_H
 #define SIM_H
 
+   #include <limits.h>
+   #include <poll.h>
    #include <stdio.h>
    #include <stdlib.h>
    #include <string.h>
+   #include <sys/inotify.h>
+   #include <unistd.h>
 
    #include <ncurses.h>
 
    #include "interpreter.h"
    #include "parser.h"
+   #include "import.h"
    #include "program.h"
    #include "machine.h"
 
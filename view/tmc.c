@@ -0,0 +1,68 @@
+
+/* The program compiler. It parses a program (in either source format, along
+   with everything it imports) and writes out its compiled image, which sim
+   and run load without parsing. By default prog.tm is compiled to prog.tmc. */
+
+#include "tmc.h"
+
+static void usage (void)
+{
+   fprintf(stderr, "Usage: tmc [-o <output-file>] <prog>\n");
+}
+
+int main (int argc, char **argv)
+{
+
+   // Options: output file.
+   char *output_file = NULL;
+   if (argc >= 3 && strcmp(argv[1], "-o") == 0) {
+      output_file = argv[2];
+      argc -= 2;
+      argv += 2;
+   }
+   if (argc != 2) {
+      usage();
+      return 1;
+   }
+
+   // Work out the output file: the input with its .tm swapped for .tmc.
+   int len = strlen(argv[1]);
+   char default_output[len + 5];
+   if (output_file == NULL) {
+      strcpy(default_output, argv[1]);
+      if (len > 3 && strcmp(argv[1] + len - 3, ".tm") == 0)
+         default_output[len - 3] = '\0';
+      strcat(default_output, ".tmc");
+      output_file = default_output;
+   }
+
+   // Parse the program.
+   Str *fname = Str_Make(argv[1]);
+   Program *prog = Parser_ProgFromFile(fname);
+   Str_Free(fname);
+   free(fname);
+   if (prog == NULL) {
+      fprintf(stderr, "Error reading file: %s\n", argv[1]);
+      return 1;
+   }
+
+   // Compile it. Programs loaded from the old image still use its file, so
+   // the new one is written beside it and moved into place, rather than
+   // written over it.
+   int status = 0;
+   char tmp[strlen(output_file) + 32];
+   snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", output_file, (long)getpid());
+   int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+   int ok = fd != -1 && Prog_Save(prog, fd) != -1;
+   if (fd != -1 && close(fd) == -1) ok = 0;
+   if (!ok || rename(tmp, output_file) == -1) {
+      fprintf(stderr, "Error writing compiled program: %s\n", output_file);
+      if (fd != -1) unlink(tmp);
+      status = 2;
+   }
+
+   Prog_Free(prog);
+   Import_Clear();
+   return status;
+
+}
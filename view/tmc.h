@@ -0,0 +1,18 @@
+
+
+#ifndef TMC_H
+#define TMC_H
+
+   #include <fcntl.h>
+   #include <stdio.h>
+   #include <stdlib.h>
+   #include <string.h>
+   #include <unistd.h>
+
+   #include "parser.h"
+   #include "import.h"
+   #include "program.h"
+
+   #include "str.h"
+
+#endif